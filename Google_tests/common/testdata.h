@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "point.h"
+#include "data.h"
+
+/*
+ * Helper Functions shared by the embedding index tests
+ */
+
+// Generates random data points for testing
+inline std::vector<Data *> generateRandomData(size_t numPoints) {
+  std::vector<Data *> data;
+  for (size_t i = 0; i < numPoints; ++i) {
+    Point embedding = Point::random();
+    std::string imagePath = "eda_" + std::to_string(i) + ".jpg";
+    Data *dataPoint = new Data(embedding, imagePath);
+    data.push_back(dataPoint);
+  }
+  return data;
+}
+
+// Exact k nearest neighbors by brute force
+inline std::vector<Data *> bruteForceKnn(std::vector<Data *> data,
+                                         const Point &query, size_t k) {
+  std::sort(data.begin(), data.end(), [&query](Data *a, Data *b) {
+      return a->getEmbedding().distance(query) <
+             b->getEmbedding().distance(query);
+  });
+  data.resize(std::min(k, data.size()));
+  return data;
+}
@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <unordered_set>
+#include <random>
+#include "point.h"
+#include "data.h"
+#include "hnsw.h"
+#include "../common/testdata.h"
+
+constexpr size_t NUM_POINTS = 1000;
+constexpr size_t NUM_QUERIES = 20;
+constexpr size_t K = 10;
+
+/*
+ * Helper Functions
+ */
+
+// Fraction of the exact neighbors returned by the index
+double recall(const std::vector<Data *> &found,
+              const std::vector<Data *> &expected) {
+  std::unordered_set<Data *> expectedSet(expected.begin(), expected.end());
+  size_t hits = 0;
+  for (Data *d: found) {
+    hits += expectedSet.count(d);
+  }
+  return static_cast<double>(hits) / static_cast<double>(expected.size());
+}
+
+/*
+ * Google Test Fixture
+ */
+class HNSWTest : public ::testing::Test {
+protected:
+    HNSW index{16, 100, 100};
+    std::vector<Data *> data;
+
+    void SetUp() override {
+      data = generateRandomData(NUM_POINTS);
+      index.build(data, 4);
+    }
+
+    void TearDown() override {
+      for (auto &d: data) {
+        delete d;
+      }
+    }
+};
+
+/*
+ * Test Cases Using the Fixture
+ */
+
+// Test 1: Check that every entry was indexed
+TEST_F(HNSWTest, AllDataIndexed) {
+  EXPECT_EQ(index.size(), NUM_POINTS);
+}
+
+// Test 2: Check that every entry is its own nearest neighbor
+TEST_F(HNSWTest, FindsItself) {
+  size_t found = 0;
+  for (Data *d: data) {
+    Point query = d->getEmbedding();
+    std::vector<Data *> result = index.knn(query, 1);
+    found += !result.empty() && result[0] == d;
+  }
+  EXPECT_GE(found, NUM_POINTS * 99 / 100);
+}
+
+// Test 3: Check recall against a brute-force scan
+TEST_F(HNSWTest, KnnRecall) {
+  double total = 0.0;
+  for (size_t q = 0; q < NUM_QUERIES; ++q) {
+    Point query = Point::random();
+    std::vector<Data *> result = index.knn(query, K);
+    ASSERT_EQ(result.size(), K);
+    total += recall(result, bruteForceKnn(data, query, K));
+  }
+  EXPECT_GE(total / NUM_QUERIES, 0.9);
+}
+
+// Test 4: Check that results are sorted from closest to farthest
+TEST_F(HNSWTest, KnnSorted) {
+  Point query = Point::random();
+  std::vector<Data *> result = index.knn(query, K);
+  for (size_t i = 1; i < result.size(); ++i) {
+    EXPECT_LE(result[i - 1]->getEmbedding().distance(query),
+              result[i]->getEmbedding().distance(query));
+  }
+}
+
+// Test 5: Check single-threaded incremental insertion
+TEST(HNSWInsertTest, IncrementalInsert) {
+  std::vector<Data *> data = generateRandomData(200);
+  HNSW index(8, 64, 64);
+  for (Data *d: data) {
+    index.insert(d);
+  }
+  Point query = data[42]->getEmbedding();
+  std::vector<Data *> result = index.knn(query, 1);
+  ASSERT_EQ(result.size(), 1u);
+  EXPECT_EQ(result[0], data[42]);
+  for (auto &d: data) {
+    delete d;
+  }
+}
+
+/*
+ * Main Function for Google Test
+ */
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <unordered_set>
+#include <random>
+#include "point.h"
+#include "data.h"
+#include "ivf.h"
+#include "../common/testdata.h"
+
+constexpr size_t NUM_POINTS = 1000;
+constexpr size_t NLIST = 16;
+constexpr size_t K = 10;
+
+/*
+ * Google Test Fixture
+ */
+class IVFTest : public ::testing::Test {
+protected:
+    IVFIndex index{NLIST, 4};
+    std::vector<Data *> data;
+
+    void SetUp() override {
+      data = generateRandomData(NUM_POINTS);
+      index.train(data, 5, 4);
+      index.insert(data, 4);
+    }
+
+    void TearDown() override {
+      for (auto &d: data) {
+        delete d;
+      }
+    }
+};
+
+/*
+ * Test Cases Using the Fixture
+ */
+
+// Test 1: Check that every entry was stored exactly once
+TEST_F(IVFTest, AllDataIndexed) {
+  std::unordered_set<Data *> stored;
+  for (size_t list = 0; list < NLIST; ++list) {
+    for (Data *d: index.getList(list)) {
+      EXPECT_TRUE(stored.insert(d).second);
+    }
+  }
+  EXPECT_EQ(stored.size(), NUM_POINTS);
+  EXPECT_EQ(index.size(), NUM_POINTS);
+}
+
+// Test 2: Check that every entry lives in the list of its nearest centroid
+TEST_F(IVFTest, EntriesInNearestList) {
+  const auto &centroids = index.getCentroids();
+  for (size_t list = 0; list < NLIST; ++list) {
+    for (Data *d: index.getList(list)) {
+      float own = d->getEmbedding().distance(centroids[list]);
+      for (const auto &centroid: centroids) {
+        EXPECT_LE(own, d->getEmbedding().distance(centroid) + 1e-4f);
+      }
+    }
+  }
+}
+
+// Test 3: Check that probing every list is an exact search
+TEST_F(IVFTest, FullProbeIsExact) {
+  index.setNprobe(NLIST);
+  Point query = Point::random();
+  EXPECT_EQ(index.knn(query, K), bruteForceKnn(data, query, K));
+}
+
+// Test 4: Check that an entry is found when its own list is probed
+TEST_F(IVFTest, FindsItself) {
+  index.setNprobe(1);
+  for (size_t i = 0; i < NUM_POINTS; i += 97) {
+    Point query = data[i]->getEmbedding();
+    std::vector<Data *> result = index.knn(query, 1);
+    ASSERT_EQ(result.size(), 1u);
+    EXPECT_EQ(result[0], data[i]);
+  }
+}
+
+// Test 5: Check that inserting before training is rejected
+TEST(IVFUntrainedTest, InsertBeforeTrainThrows) {
+  IVFIndex index(4);
+  Data d(Point::random(), "eda_0.jpg");
+  EXPECT_THROW(index.insert(&d), std::logic_error);
+}
+
+/*
+ * Main Function for Google Test
+ */
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
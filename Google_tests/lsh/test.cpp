@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <random>
+#include "point.h"
+#include "data.h"
+#include "lsh.h"
+#include "../common/testdata.h"
+
+constexpr size_t NUM_POINTS = 1000;
+constexpr float NOISE = 0.01f;
+
+/*
+ * Helper Functions
+ */
+
+// Returns a slightly perturbed copy of a point (a near-duplicate)
+Point perturb(const Point &point) {
+  return point + Point::random(-NOISE, NOISE);
+}
+
+/*
+ * Google Test Fixture
+ */
+class LSHTest : public ::testing::TestWithParam<LSHFamily> {
+protected:
+    LSHIndex index{GetParam(), 8, 12, 4.0f, 4};
+    std::vector<Data *> data;
+
+    void SetUp() override {
+      data = generateRandomData(NUM_POINTS);
+      for (Data *d: data) {
+        index.insert(d);
+      }
+    }
+
+    void TearDown() override {
+      for (auto &d: data) {
+        delete d;
+      }
+    }
+};
+
+/*
+ * Test Cases Using the Fixture
+ */
+
+// Test 1: Check that every entry was indexed
+TEST_P(LSHTest, AllDataIndexed) {
+  EXPECT_EQ(index.size(), NUM_POINTS);
+}
+
+// Test 2: Check that an exact duplicate is always a candidate
+TEST_P(LSHTest, ExactDuplicateIsCandidate) {
+  for (size_t i = 0; i < NUM_POINTS; i += 50) {
+    std::vector<Data *> found = index.candidates(data[i]->getEmbedding());
+    EXPECT_NE(std::find(found.begin(), found.end(), data[i]), found.end());
+  }
+}
+
+// Test 3: Check that near-duplicates are found as nearest neighbors
+TEST_P(LSHTest, FindsNearDuplicates) {
+  size_t found = 0, total = 0;
+  for (size_t i = 0; i < NUM_POINTS; i += 20, ++total) {
+    Point query = perturb(data[i]->getEmbedding());
+    std::vector<Data *> result = index.knn(query, 1);
+    found += !result.empty() && result[0] == data[i];
+  }
+  EXPECT_GE(found, total * 95 / 100);
+}
+
+// Test 4: Check that nearDuplicates respects the radius
+TEST_P(LSHTest, NearDuplicatesWithinRadius) {
+  Point query = perturb(data[7]->getEmbedding());
+  float radius = 1.0f;
+  std::vector<Data *> result = index.nearDuplicates(query, radius);
+  ASSERT_FALSE(result.empty());
+  EXPECT_EQ(result[0], data[7]);
+  for (Data *d: result) {
+    EXPECT_LE(Point::distance(query, d->getEmbedding()), radius);
+  }
+}
+
+// Test 5: Check that multi-probe never returns fewer candidates
+TEST_P(LSHTest, MultiProbeAddsCandidates) {
+  Point query = Point::random();
+  index.setNumProbes(0);
+  size_t single = index.candidates(query).size();
+  index.setNumProbes(16);
+  EXPECT_GE(index.candidates(query).size(), single);
+}
+
+INSTANTIATE_TEST_SUITE_P(Families, LSHTest,
+                         ::testing::Values(COSINE, EUCLIDEAN));
+
+TEST(LSHArgumentsTest, RejectsEmptyParameters) {
+  EXPECT_THROW(LSHIndex(EUCLIDEAN, 0), std::invalid_argument);
+  EXPECT_THROW(LSHIndex(EUCLIDEAN, 8, 0), std::invalid_argument);
+  EXPECT_THROW(LSHIndex(EUCLIDEAN, 8, 12, 0.0f), std::invalid_argument);
+  EXPECT_THROW(LSHIndex(COSINE, 8, 12, -1.0f), std::invalid_argument);
+  EXPECT_THROW(LSHIndex(EUCLIDEAN, 8, 12, std::nanf("")),
+               std::invalid_argument);
+}
+
+/*
+ * Main Function for Google Test
+ */
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
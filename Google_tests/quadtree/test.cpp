@@ -3,7 +3,9 @@
 #include <set>
 #include <random>
 #include <vector>
+#include <numeric>
 #include "quadtree.h"
+#include "linearquadtree.h"
 
 void printHello() {
     std::cout << "Hello, World!\n";
@@ -17,10 +19,11 @@ TEST(HelloWorldTest, PrintHello) {
 }
 
 
-std::vector<std::shared_ptr<Particle>>
+ParticleSystem
 generateRandomParticles(int n, const Rect &boundary,
                         NType maxVelocityMagnitude) {
-    std::vector<std::shared_ptr<Particle>> particles;
+    ParticleSystem particles;
+    particles.reserve(n);
     std::random_device rd;
     std::mt19937 gen(rd());
     std::uniform_real_distribution<float> posDistX(
@@ -41,40 +44,42 @@ generateRandomParticles(int n, const Rect &boundary,
         NType vy = NType(velDist(gen));
         Point2D velocity(vx, vy);
 
-        auto particle = std::make_shared<Particle>(position, velocity);
-        particles.push_back(particle);
+        particles.add(position, velocity);
     }
 
     return particles;
 }
 
 void traverseTree(QuadNode *node,
-                  std::set<std::shared_ptr<Particle>> &foundParticles) {
+                  std::vector<size_t> &timesFound) {
     if (node->isLeaf()) {
-        for (const auto &particle: node->getParticles()) {
-            foundParticles.insert(particle);
+        for (ParticleSystem::Index particle: node->getParticles()) {
+            timesFound[particle]++;
         }
     } else {
         for (const auto &child: node->getChildren()) {
             if (child) {
-                traverseTree(child.get(), foundParticles);
+                traverseTree(child, timesFound);
             }
         }
     }
 }
 
 bool verifyAllDataIndexed(QuadNode *rootNode,
-                          const std::set<std::shared_ptr<Particle>> &insertedParticles) {
-    std::set<std::shared_ptr<Particle>> foundParticles;
-    traverseTree(rootNode, foundParticles);
-
-    for (const auto &particle: insertedParticles) {
-        if (foundParticles.find(particle) == foundParticles.end()) {
-            std::cout << "Missing particle: " << particle->getPosition()
-                      << std::endl;
+                          const ParticleSystem &insertedParticles) {
+    std::vector<size_t> timesFound(insertedParticles.size(), 0);
+    traverseTree(rootNode, timesFound);
+
+    bool indexedOnce = true;
+    for (ParticleSystem::Index i = 0; i < insertedParticles.size(); ++i) {
+        if (timesFound[i] != 1) {
+            std::cout << "Particle " << i << " at "
+                      << insertedParticles.getPosition(i) << " indexed "
+                      << timesFound[i] << " times" << std::endl;
+            indexedOnce = false;
         }
     }
-    return foundParticles == insertedParticles;
+    return indexedOnce;
 }
 
 bool traverseAndCheckInternalNodes(QuadNode *node) {
@@ -86,7 +91,7 @@ bool traverseAndCheckInternalNodes(QuadNode *node) {
         }
         for (const auto &child: node->getChildren()) {
             if (child) {
-                if (!traverseAndCheckInternalNodes(child.get())) {
+                if (!traverseAndCheckInternalNodes(child)) {
                     return false;
                 }
             }
@@ -109,7 +114,7 @@ bool traverseAndCheckLeafNodes(QuadNode *node) {
     } else {
         for (const auto &child: node->getChildren()) {
             if (child) {
-                if (!traverseAndCheckLeafNodes(child.get())) {
+                if (!traverseAndCheckLeafNodes(child)) {
                     return false;
                 }
             }
@@ -130,7 +135,7 @@ bool traverseAndCheckBucketSize(QuadNode *node, size_t bucketSize) {
     } else {
         for (const auto &child: node->getChildren()) {
             if (child) {
-                if (!traverseAndCheckBucketSize(child.get(), bucketSize)) {
+                if (!traverseAndCheckBucketSize(child, bucketSize)) {
                     return false;
                 }
             }
@@ -152,7 +157,7 @@ bool traverseAndCheckBoundaries(QuadNode *node) {
         }
         for (const auto &child: node->getChildren()) {
             if (child) {
-                if (!traverseAndCheckBoundaries(child.get())) {
+                if (!traverseAndCheckBoundaries(child)) {
                     return false;
                 }
             }
@@ -179,7 +184,7 @@ bool traverseAndCheckNoIntersections(QuadNode *node) {
         }
         for (const auto &child: node->getChildren()) {
             if (child) {
-                if (!traverseAndCheckNoIntersections(child.get())) {
+                if (!traverseAndCheckNoIntersections(child)) {
                     return false;
                 }
             }
@@ -192,17 +197,20 @@ bool verifyNoIntersectingChildBoundaries(QuadNode *rootNode) {
     return traverseAndCheckNoIntersections(rootNode);
 }
 
-bool traverseAndCheckParticlesInCorrectLeaf(QuadNode *node) {
+bool traverseAndCheckParticlesInCorrectLeaf(QuadNode *node,
+                                            const ParticleSystem &particles) {
     if (node->isLeaf()) {
-        for (const auto &particle: node->getParticles()) {
-            if (!node->getBoundary().contains(particle->getPosition())) {
+        for (ParticleSystem::Index particle: node->getParticles()) {
+            if (!node->getBoundary().contains(
+                    particles.getPosition(particle))) {
                 return false;
             }
         }
     } else {
         for (const auto &child: node->getChildren()) {
             if (child) {
-                if (!traverseAndCheckParticlesInCorrectLeaf(child.get())) {
+                if (!traverseAndCheckParticlesInCorrectLeaf(child,
+                                                            particles)) {
                     return false;
                 }
             }
@@ -211,13 +219,13 @@ bool traverseAndCheckParticlesInCorrectLeaf(QuadNode *node) {
     return true;
 }
 
-bool verifyParticlesInCorrectLeaf(QuadNode *rootNode) {
-    return traverseAndCheckParticlesInCorrectLeaf(rootNode);
+bool verifyParticlesInCorrectLeaf(QuadNode *rootNode,
+                                  const ParticleSystem &particles) {
+    return traverseAndCheckParticlesInCorrectLeaf(rootNode, particles);
 }
 
 
-bool verifyKNN(QuadTree &tree,
-               const std::vector<std::shared_ptr<Particle>> &particles,
+bool verifyKNN(QuadTree &tree, const ParticleSystem &particles,
                const Rect &boundary) {
     // Generar un punto de consulta aleatorio dentro del boundary
     std::random_device rd;
@@ -237,15 +245,16 @@ bool verifyKNN(QuadTree &tree,
     size_t k = std::uniform_int_distribution<size_t>(1, 10)(gen);
 
     // Obtener k-NN usando QuadTree
-    std::vector<std::shared_ptr<Particle>> knnTree = tree.knn(queryPoint, k);
+    std::vector<ParticleSystem::Index> knnTree = tree.knn(queryPoint, k);
 
     // Obtener k-NN usando fuerza bruta
-    std::vector<std::shared_ptr<Particle>> knnBruteForce = particles;
+    std::vector<ParticleSystem::Index> knnBruteForce(particles.size());
+    std::iota(knnBruteForce.begin(), knnBruteForce.end(), 0);
     std::sort(knnBruteForce.begin(), knnBruteForce.end(),
-              [&queryPoint](const std::shared_ptr<Particle> &a,
-                            const std::shared_ptr<Particle> &b) {
-                  return queryPoint.distance(a->getPosition()) <
-                         queryPoint.distance(b->getPosition());
+              [&queryPoint, &particles](ParticleSystem::Index a,
+                                        ParticleSystem::Index b) {
+                  return queryPoint.distance(particles.getPosition(a)) <
+                         queryPoint.distance(particles.getPosition(b));
               });
     knnBruteForce.resize(k); // Seleccionar los primeros k vecinos más cercanos
 
@@ -262,18 +271,15 @@ bool verifyKNN(QuadTree &tree,
     return true;
 }
 
-void updateParticles(const Rect &boundary,
-                     std::vector<std::shared_ptr<Particle>> &particles) {
-    for (auto &particle: particles) {
-        particle->updatePosition(boundary);
-    }
+void updateParticles(const Rect &boundary, ParticleSystem &particles) {
+    particles.updatePositions(boundary);
 }
 
 class QuadTreeTest : public ::testing::Test {
 protected:
     Rect boundary;
     QuadTree tree;
-    std::vector<std::shared_ptr<Particle>> particles;
+    ParticleSystem particles;
 
     void SetUp() override {
         boundary = Rect(Point2D(0, 0), Point2D(100, 100));
@@ -287,33 +293,32 @@ protected:
 };
 
 TEST_F(QuadTreeTest, AllDataIndexed) {
-    EXPECT_TRUE(verifyAllDataIndexed(tree.getRoot().get(),
-                                     {particles.begin(), particles.end()}));
+    EXPECT_TRUE(verifyAllDataIndexed(tree.getRoot(), particles));
 }
 
 TEST_F(QuadTreeTest, InternalNodesNotLeaf) {
-    EXPECT_TRUE(verifyInternalNodesNotLeaf(tree.getRoot().get()));
+    EXPECT_TRUE(verifyInternalNodesNotLeaf(tree.getRoot()));
 }
 
 TEST_F(QuadTreeTest, LeafNodesHaveNoChildren) {
-    EXPECT_TRUE(verifyLeafNodesHaveNoChildren(tree.getRoot().get()));
+    EXPECT_TRUE(verifyLeafNodesHaveNoChildren(tree.getRoot()));
 }
 
 TEST_F(QuadTreeTest, LeafNodesBucketSize) {
-    EXPECT_TRUE(verifyLeafNodesBucketSize(tree.getRoot().get(),
+    EXPECT_TRUE(verifyLeafNodesBucketSize(tree.getRoot(),
                                           QuadTree::bucketSize));
 }
 
 TEST_F(QuadTreeTest, ChildBoundariesWithinParent) {
-    EXPECT_TRUE(verifyChildBoundariesWithinParent(tree.getRoot().get()));
+    EXPECT_TRUE(verifyChildBoundariesWithinParent(tree.getRoot()));
 }
 
 TEST_F(QuadTreeTest, NoIntersectingChildBoundaries) {
-    EXPECT_TRUE(verifyNoIntersectingChildBoundaries(tree.getRoot().get()));
+    EXPECT_TRUE(verifyNoIntersectingChildBoundaries(tree.getRoot()));
 }
 
 TEST_F(QuadTreeTest, ParticlesInCorrectLeaf) {
-    EXPECT_TRUE(verifyParticlesInCorrectLeaf(tree.getRoot().get()));
+    EXPECT_TRUE(verifyParticlesInCorrectLeaf(tree.getRoot(), particles));
 }
 
 TEST_F(QuadTreeTest, KnnSearch) {
@@ -324,7 +329,7 @@ class QuadTreeUpdatedTest : public ::testing::Test {
 protected:
     Rect boundary;
     QuadTree tree;
-    std::vector<std::shared_ptr<Particle>> particles;
+    ParticleSystem particles;
 
     void SetUp() override {
         boundary = Rect(Point2D(0, 0), Point2D(100, 100));
@@ -345,39 +350,451 @@ protected:
 };
 
 TEST_F(QuadTreeUpdatedTest, AllDataIndexed) {
-    EXPECT_TRUE(verifyAllDataIndexed(tree.getRoot().get(),
-                                     {particles.begin(), particles.end()}));
+    EXPECT_TRUE(verifyAllDataIndexed(tree.getRoot(), particles));
 }
 
 TEST_F(QuadTreeUpdatedTest, InternalNodesNotLeaf) {
-    EXPECT_TRUE(verifyInternalNodesNotLeaf(tree.getRoot().get()));
+    EXPECT_TRUE(verifyInternalNodesNotLeaf(tree.getRoot()));
 }
 
 TEST_F(QuadTreeUpdatedTest, LeafNodesHaveNoChildren) {
-    EXPECT_TRUE(verifyLeafNodesHaveNoChildren(tree.getRoot().get()));
+    EXPECT_TRUE(verifyLeafNodesHaveNoChildren(tree.getRoot()));
 }
 
 TEST_F(QuadTreeUpdatedTest, LeafNodesBucketSize) {
-    EXPECT_TRUE(verifyLeafNodesBucketSize(tree.getRoot().get(),
+    EXPECT_TRUE(verifyLeafNodesBucketSize(tree.getRoot(),
                                           QuadTree::bucketSize));
 }
 
 TEST_F(QuadTreeUpdatedTest, ChildBoundariesWithinParent) {
-    EXPECT_TRUE(verifyChildBoundariesWithinParent(tree.getRoot().get()));
+    EXPECT_TRUE(verifyChildBoundariesWithinParent(tree.getRoot()));
 }
 
 TEST_F(QuadTreeUpdatedTest, NoIntersectingChildBoundaries) {
-    EXPECT_TRUE(verifyNoIntersectingChildBoundaries(tree.getRoot().get()));
+    EXPECT_TRUE(verifyNoIntersectingChildBoundaries(tree.getRoot()));
 }
 
 TEST_F(QuadTreeUpdatedTest, ParticlesInCorrectLeaf) {
-    EXPECT_TRUE(verifyParticlesInCorrectLeaf(tree.getRoot().get()));
+    EXPECT_TRUE(verifyParticlesInCorrectLeaf(tree.getRoot(), particles));
 }
 
 TEST_F(QuadTreeUpdatedTest, KnnSearch) {
     EXPECT_TRUE(verifyKNN(tree, particles, boundary));
 }
 
+TEST(QuadTreeParallelUpdateTest, MatchesInvariantsOverSeveralFrames) {
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    QuadTree tree(boundary);
+    ParticleSystem particles = generateRandomParticles(100000, boundary, 20.0);
+    tree.insert(particles);
+
+    for (int frame = 0; frame < 3; ++frame) {
+        particles.updatePositions(boundary);
+        tree.updateTree(4);
+        ASSERT_TRUE(verifyAllDataIndexed(tree.getRoot(), particles));
+        ASSERT_TRUE(verifyParticlesInCorrectLeaf(tree.getRoot(),
+                                                 particles));
+        ASSERT_TRUE(verifyLeafNodesBucketSize(tree.getRoot(),
+                                              QuadTree::bucketSize));
+    }
+    EXPECT_TRUE(verifyKNN(tree, particles, boundary));
+}
+
+TEST(QuadTreeIncrementalUpdateTest, RelocatesOnlyMovedParticles) {
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    QuadTree tree(boundary);
+    // Slow enough that only a few percent leave their leaf each frame
+    ParticleSystem particles = generateRandomParticles(100000, boundary, 0.05);
+    tree.insert(particles);
+
+    for (int frame = 0; frame < 3; ++frame) {
+        particles.updatePositions(boundary);
+        tree.updateMoved(4);
+        ASSERT_TRUE(verifyAllDataIndexed(tree.getRoot(), particles));
+        ASSERT_TRUE(verifyParticlesInCorrectLeaf(tree.getRoot(),
+                                                 particles));
+        ASSERT_TRUE(verifyLeafNodesBucketSize(tree.getRoot(),
+                                              QuadTree::bucketSize));
+    }
+    for (ParticleSystem::Index i = 0; i < particles.size(); ++i) {
+        const QuadNode *leaf = tree.getOwner(i);
+        ASSERT_TRUE(leaf->isLeaf());
+        const auto &bucket = leaf->getParticles();
+        ASSERT_NE(std::find(bucket.begin(), bucket.end(), i), bucket.end());
+    }
+    EXPECT_TRUE(verifyKNN(tree, particles, boundary));
+}
+
+size_t countNodes(const QuadNode *node) {
+    size_t count = 1;
+    for (const auto &child: node->getChildren()) {
+        if (child) {
+            count += countNodes(child);
+        }
+    }
+    return count;
+}
+
+size_t maxDepth(const QuadNode *node) {
+    size_t depth = 0;
+    for (const auto &child: node->getChildren()) {
+        if (child) {
+            depth = std::max(depth, 1 + maxDepth(child));
+        }
+    }
+    return depth;
+}
+
+bool verifyNoUnderfullSubtrees(const QuadNode *node, size_t threshold) {
+    if (node->isLeaf()) {
+        return true;
+    }
+    size_t total = 0;
+    bool childrenAreLeaves = true;
+    for (const auto &child: node->getChildren()) {
+        if (child) {
+            if (!verifyNoUnderfullSubtrees(child, threshold)) {
+                return false;
+            }
+            childrenAreLeaves = childrenAreLeaves && child->isLeaf();
+            total += child->getParticles().size();
+        }
+    }
+    return !childrenAreLeaves || total > threshold;
+}
+
+/**
+ * A dense cluster of fast particles inside a sparse, static background.
+ * The cluster sits in the lower corner of the boundary, 1% to 2% of its
+ * extent in, and moves up to 30% of the extent per step, so it forces a
+ * deep branch that should merge once it disperses.
+ */
+ParticleSystem generateDispersingCluster(const Rect &boundary,
+                                         size_t background, size_t cluster) {
+    double minX = boundary.getPmin().getX().getValue();
+    double minY = boundary.getPmin().getY().getValue();
+    double width = boundary.getPmax().getX().getValue() - minX;
+    double height = boundary.getPmax().getY().getValue() - minY;
+
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<double> anywhereX(minX, minX + width);
+    std::uniform_real_distribution<double> anywhereY(minY, minY + height);
+    std::uniform_real_distribution<double> cornerX(minX + 0.01 * width,
+                                                   minX + 0.02 * width);
+    std::uniform_real_distribution<double> cornerY(minY + 0.01 * height,
+                                                   minY + 0.02 * height);
+    std::uniform_real_distribution<double> speedX(-0.3 * width, 0.3 * width);
+    std::uniform_real_distribution<double> speedY(-0.3 * height,
+                                                  0.3 * height);
+    ParticleSystem particles;
+    for (size_t i = 0; i < background; ++i) {
+        particles.add(Point2D(anywhereX(gen), anywhereY(gen)),
+                      Point2D(0, 0));
+    }
+    for (size_t i = 0; i < cluster; ++i) {
+        particles.add(Point2D(cornerX(gen), cornerY(gen)),
+                      Point2D(speedX(gen), speedY(gen)));
+    }
+    return particles;
+}
+
+TEST(QuadTreeCollapseTest, FullUpdateMergesDispersedBranches) {
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    for (size_t threads: {1, 4}) {
+        QuadTree tree(boundary);
+        ParticleSystem particles = generateDispersingCluster(boundary, 2000,
+                                                             2000);
+        tree.insert(particles);
+        size_t before = countNodes(tree.getRoot());
+
+        particles.updatePositions(boundary);
+        tree.updateTree(threads);
+        EXPECT_LT(countNodes(tree.getRoot()), before);
+        EXPECT_TRUE(verifyNoUnderfullSubtrees(tree.getRoot(),
+                                              QuadTree::collapseThreshold()));
+        EXPECT_TRUE(verifyAllDataIndexed(tree.getRoot(), particles));
+        EXPECT_TRUE(verifyParticlesInCorrectLeaf(tree.getRoot(),
+                                                 particles));
+        EXPECT_TRUE(verifyLeafNodesBucketSize(tree.getRoot(),
+                                              QuadTree::bucketSize));
+        EXPECT_TRUE(verifyKNN(tree, particles, boundary));
+    }
+}
+
+TEST(QuadTreeCollapseTest, IncrementalUpdateMergesDispersedBranches) {
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    QuadTree tree(boundary);
+    // Few enough movers that updateMoved does not fall back to updateTree
+    ParticleSystem particles = generateDispersingCluster(boundary, 20000,
+                                                         1000);
+    tree.insert(particles);
+    size_t before = maxDepth(tree.getRoot());
+
+    particles.updatePositions(boundary);
+    tree.updateMoved();
+    EXPECT_LT(maxDepth(tree.getRoot()), before);
+    EXPECT_TRUE(verifyNoUnderfullSubtrees(tree.getRoot(),
+                                          QuadTree::collapseThreshold()));
+    EXPECT_TRUE(verifyAllDataIndexed(tree.getRoot(), particles));
+    EXPECT_TRUE(verifyParticlesInCorrectLeaf(tree.getRoot(), particles));
+    for (ParticleSystem::Index i = 0; i < particles.size(); ++i) {
+        ASSERT_TRUE(tree.getOwner(i)->isLeaf());
+    }
+}
+
+bool verifyLinearCells(const LinearQuadTree &tree,
+                       const ParticleSystem &particles) {
+    const auto &codes = tree.getCodes();
+    const auto &order = tree.getOrder();
+    if (!std::is_sorted(codes.begin(), codes.end())) {
+        return false;
+    }
+    std::vector<bool> seen(particles.size(), false);
+    for (ParticleSystem::Index i: order) {
+        if (seen[i]) {
+            return false;
+        }
+        seen[i] = true;
+    }
+    for (const auto &cell: tree.getCells()) {
+        for (uint32_t slot = cell.begin; slot < cell.end; ++slot) {
+            double x = particles.getX(order[slot]);
+            double y = particles.getY(order[slot]);
+            if (x < cell.xmin - 1e-9 || x > cell.xmax + 1e-9 ||
+                y < cell.ymin - 1e-9 || y > cell.ymax + 1e-9) {
+                return false;
+            }
+        }
+    }
+    return order.size() == particles.size();
+}
+
+TEST(LinearQuadTreeTest, KnnMatchesQuadTree) {
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    ParticleSystem particles = generateRandomParticles(50000, boundary, 5.0);
+    QuadTree tree(boundary);
+    tree.insert(particles);
+    LinearQuadTree linear(boundary);
+
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<double> coordinate(0, 100);
+    for (int frame = 0; frame < 2; ++frame) {
+        linear.build(particles, 4);
+        ASSERT_TRUE(verifyLinearCells(linear, particles));
+        for (int query = 0; query < 50; ++query) {
+            Point2D queryPoint(coordinate(gen), coordinate(gen));
+            auto expected = tree.knn(queryPoint, 10);
+            auto actual = linear.knn(queryPoint, 10);
+            ASSERT_EQ(actual.size(), expected.size());
+            for (size_t i = 0; i < actual.size(); ++i) {
+                EXPECT_NEAR(static_cast<double>(queryPoint.distance(
+                                    particles.getPosition(actual[i])).getValue()),
+                            static_cast<double>(queryPoint.distance(
+                                    particles.getPosition(expected[i])).getValue()),
+                            1e-9);
+            }
+        }
+        particles.updatePositions(boundary);
+        tree.updateTree();
+    }
+}
+
+TEST(LinearQuadTreeTest, ParallelBuildMatchesSerial) {
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    ParticleSystem particles = generateRandomParticles(100000, boundary, 5.0);
+    LinearQuadTree serial(boundary), parallel(boundary);
+    serial.build(particles, 1);
+    parallel.build(particles, 4);
+    EXPECT_EQ(serial.getCodes(), parallel.getCodes());
+    EXPECT_EQ(serial.getOrder(), parallel.getOrder());
+    EXPECT_EQ(serial.getCells().size(), parallel.getCells().size());
+}
+
+TEST(QuadNodePoolTest, CollapsedGroupsReturnToFreeList) {
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    QuadTree tree(boundary);
+    ParticleSystem particles = generateDispersingCluster(boundary, 2000, 2000);
+    tree.insert(particles);
+
+    particles.updatePositions(boundary);
+    tree.updateTree(1);
+    const QuadNodePool &pool = tree.getPool();
+    EXPECT_GT(pool.getFreeGroups(), 0u);
+    // Every allocated node is either reachable, free, or one of the three
+    // unused group mates of the root
+    EXPECT_EQ(pool.getAllocatedNodes(),
+              countNodes(tree.getRoot()) + 4 * pool.getFreeGroups() + 3);
+
+    // Nodes are linked by index inside the pool, so moving the tree keeps
+    // it intact
+    QuadTree moved = std::move(tree);
+    EXPECT_TRUE(verifyAllDataIndexed(moved.getRoot(), particles));
+    EXPECT_TRUE(verifyKNN(moved, particles, boundary));
+}
+
+TEST(QuadTreeRangeQueryTest, MatchesBruteForce) {
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    QuadTree tree(boundary);
+    ParticleSystem particles = generateRandomParticles(50000, boundary, 5.0);
+    tree.insert(particles);
+    particles.updatePositions(boundary);
+    tree.updateTree();
+
+    std::mt19937 gen(11);
+    std::uniform_real_distribution<double> coordinate(-10, 110);
+    std::uniform_real_distribution<double> extent(0, 40);
+    std::vector<ParticleSystem::Index> found;
+    for (int query = 0; query < 50; ++query) {
+        double x = coordinate(gen), y = coordinate(gen);
+        Rect range(Point2D(x, y), Point2D(x + extent(gen), y + extent(gen)));
+        tree.queryRect(range, found);
+        std::vector<ParticleSystem::Index> expected;
+        for (ParticleSystem::Index i = 0; i < particles.size(); ++i) {
+            if (range.contains(particles.getPosition(i))) {
+                expected.push_back(i);
+            }
+        }
+        std::sort(found.begin(), found.end());
+        ASSERT_EQ(found, expected);
+
+        Point2D center(x, y);
+        double radius = extent(gen);
+        tree.queryRadius(center, radius, found);
+        expected.clear();
+        for (ParticleSystem::Index i = 0; i < particles.size(); ++i) {
+            double dx = particles.getX(i) - x, dy = particles.getY(i) - y;
+            if (dx * dx + dy * dy <= radius * radius) {
+                expected.push_back(i);
+            }
+        }
+        std::sort(found.begin(), found.end());
+        ASSERT_EQ(found, expected);
+    }
+
+    size_t everything = 0;
+    tree.queryRect(boundary, [&everything](ParticleSystem::Index) {
+        everything++;
+    });
+    EXPECT_EQ(everything, particles.size());
+}
+
+TEST(QuadTreeRangeQueryTest, FindsParticlesOnTheToleranceBand) {
+    // The root accepts a particle just past its edge, within NType's
+    // tolerance, so both queries must still reach it
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    QuadTree tree(boundary);
+    ParticleSystem particles;
+    particles.add(Point2D(100.0000005, 50), Point2D(0, 0));
+    tree.insert(particles);
+    ASSERT_TRUE(verifyAllDataIndexed(tree.getRoot(), particles));
+
+    std::vector<ParticleSystem::Index> found;
+    tree.queryRect(Rect(Point2D(100, 0), Point2D(110, 100)), found);
+    EXPECT_EQ(found.size(), 1u);
+    tree.queryRadius(Point2D(100.0000009, 50), 5e-7, found);
+    EXPECT_EQ(found.size(), 1u);
+}
+
+TEST(QuadTreeCollisionTest, PairsMatchBruteForce) {
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    QuadTree tree(boundary);
+    ParticleSystem particles = generateRandomParticles(4000, boundary, 5.0);
+    tree.insert(particles);
+    particles.updatePositions(boundary);
+    tree.updateTree();
+
+    for (double radius: {0.0, 0.5, 3.0}) {
+        std::vector<ParticlePair> expected;
+        for (ParticleSystem::Index i = 0; i < particles.size(); ++i) {
+            for (ParticleSystem::Index j = i + 1; j < particles.size(); ++j) {
+                double dx = particles.getX(i) - particles.getX(j);
+                double dy = particles.getY(i) - particles.getY(j);
+                if (dx * dx + dy * dy <= radius * radius) {
+                    expected.emplace_back(i, j);
+                }
+            }
+        }
+        for (size_t threads: {1, 4}) {
+            std::vector<ParticlePair> pairs;
+            tree.collisionPairs(radius, pairs, threads);
+            std::sort(pairs.begin(), pairs.end());
+            ASSERT_EQ(pairs, expected) << "radius " << radius;
+        }
+    }
+}
+
+TEST(QuadTreeKnnTest, HandlesSmallTreesAndLargeK) {
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    QuadTree tree(boundary);
+    ParticleSystem particles;
+    particles.add(Point2D(10, 10), Point2D(0, 0));
+    particles.add(Point2D(20, 20), Point2D(0, 0));
+    particles.add(Point2D(90, 90), Point2D(0, 0));
+    tree.insert(particles);
+
+    EXPECT_TRUE(tree.knn(Point2D(0, 0), 0).empty());
+    EXPECT_EQ(tree.knn(Point2D(0, 0), 10),
+              (std::vector<ParticleSystem::Index>{0, 1, 2}));
+    EXPECT_EQ(tree.knn(Point2D(100, 100), 2),
+              (std::vector<ParticleSystem::Index>{2, 1}));
+}
+
+TEST(QuadTreeInsertTest, IndexesAppendedParticlesOnce) {
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    QuadTree tree(boundary);
+    ParticleSystem particles = generateRandomParticles(500, boundary, 1.0);
+    tree.insert(particles);
+
+    ParticleSystem more = generateRandomParticles(300, boundary, 1.0);
+    for (ParticleSystem::Index i = 0; i < more.size(); ++i) {
+        particles.add(more.getPosition(i), Point2D(0, 0));
+    }
+    tree.insert(particles);
+    tree.insert(particles);
+    EXPECT_TRUE(verifyAllDataIndexed(tree.getRoot(), particles));
+    EXPECT_TRUE(verifyParticlesInCorrectLeaf(tree.getRoot(), particles));
+
+    ParticleSystem other = generateRandomParticles(10, boundary, 1.0);
+    EXPECT_THROW(tree.insert(other), std::invalid_argument);
+}
+
+TEST(ParticleSystemTest, ReflectionMatchesHandComputedBounces) {
+    // dt = 1.5, walls at 0 and 100
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    ParticleSystem particles;
+    particles.add(Point2D(10, 50), Point2D(-20, 0));   // One bounce on xmin
+    particles.add(Point2D(90, 50), Point2D(100, 0));   // Two bounces
+    particles.add(Point2D(50, 50), Point2D(3, -4));    // No bounce
+    particles.add(Point2D(50, 99), Point2D(0, 300));   // Five bounces on y
+    particles.updatePositions(boundary);
+
+    EXPECT_DOUBLE_EQ(particles.getX(0), 20.0);
+    EXPECT_DOUBLE_EQ(particles.velocitiesX()[0], 20.0);
+    EXPECT_DOUBLE_EQ(particles.getX(1), 40.0);
+    EXPECT_DOUBLE_EQ(particles.velocitiesX()[1], 100.0);
+    EXPECT_DOUBLE_EQ(particles.getX(2), 54.5);
+    EXPECT_DOUBLE_EQ(particles.getY(2), 44.0);
+    EXPECT_DOUBLE_EQ(particles.getY(3), 51.0);
+    EXPECT_DOUBLE_EQ(particles.velocitiesY()[3], -300.0);
+}
+
+TEST(ParticleSystemTest, ParallelUpdateMatchesSerial) {
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    ParticleSystem serial = generateRandomParticles(100000, boundary, 200.0);
+    ParticleSystem parallel = serial;
+    for (int step = 0; step < 3; ++step) {
+        serial.updatePositions(boundary, 1);
+        parallel.updatePositions(boundary, 4);
+    }
+    EXPECT_EQ(serial.positionsX(), parallel.positionsX());
+    EXPECT_EQ(serial.positionsY(), parallel.positionsY());
+    EXPECT_EQ(serial.velocitiesX(), parallel.velocitiesX());
+    EXPECT_EQ(serial.velocitiesY(), parallel.velocitiesY());
+    for (ParticleSystem::Index i = 0; i < serial.size(); ++i) {
+        ASSERT_TRUE(boundary.contains(serial.getPosition(i)));
+    }
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
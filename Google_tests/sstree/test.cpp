@@ -2,9 +2,19 @@
 #include <vector>
 #include <unordered_set>
 #include <random>
+#include <set>
+#include <thread>
+#include <limits>
 #include "point.h"
 #include "data.h"
 #include "sstree.h"
+#include "shardedsstree.h"
+#include "pagedsstree.h"
+#include "durablesstree.h"
+#include "embeddingreader.h"
+#include "querycache.h"
+#include "../common/testdata.h"
+#include <filesystem>
 
 constexpr size_t NUM_POINTS = 100;
 constexpr size_t MAX_POINTS_PER_NODE = 20;
@@ -13,18 +23,6 @@ constexpr size_t MAX_POINTS_PER_NODE = 20;
  * Helper Functions
  */
 
-// Generates random data points for testing
-std::vector<Data *> generateRandomData(size_t numPoints) {
-  std::vector<Data *> data;
-  for (size_t i = 0; i < numPoints; ++i) {
-    Point embedding = Point::random();
-    std::string imagePath = "eda_" + std::to_string(i) + ".jpg";
-    Data *dataPoint = new Data(embedding, imagePath);
-    data.push_back(dataPoint);
-  }
-  return data;
-}
-
 // Collects data from the tree using DFS
 void collectDataDFS(SSNode *node, std::unordered_set<Data *> &treeData) {
   if (node->getIsLeaf()) {
@@ -62,10 +60,10 @@ bool noNodeExceedsMaxChildrenDFS(SSNode *node, size_t maxPointsPerNode) {
 // Helper function to check if all points are inside the bounding sphere of their respective nodes
 bool sphereCoversAllPointsDFS(SSNode *node) {
   if (!node->getIsLeaf()) return true;
-  const Point &centroid = node->getCentroid();
+  const Point &center = node->getCenter();
   float radius = node->getRadius();
   for (const auto &data: node->getData()) {
-    if (Point::distance(centroid, data->getEmbedding()) > radius) return false;
+    if (Point::distance(center, data->getEmbedding()) > radius) return false;
   }
   return true;
 }
@@ -89,12 +87,12 @@ bool sphereCoversAllPoints(SSNode *root) {
 // Helper function to check if all children are inside the bounding sphere of their parent node
 bool sphereCoversAllChildrenSpheresDFS(SSNode *node) {
   if (node->getIsLeaf()) return true;
-  const Point &centroid = node->getCentroid();
+  const Point &center = node->getCenter();
   float radius = node->getRadius();
   for (const auto &child: node->getChildren()) {
-    const Point &childCentroid = child->getCentroid();
+    const Point &childCenter = child->getCenter();
     float childRadius = child->getRadius();
-    if (Point::distance(centroid, childCentroid) + childRadius > radius)
+    if (Point::distance(center, childCenter) + childRadius > radius)
       return false;
   }
   return true;
@@ -179,6 +177,790 @@ TEST_F(SSTreeTest, SphereCoversAllChildrenSpheres) {
   EXPECT_TRUE(sphereCoversAllChildrenSpheres(tree.getRoot()));
 }
 
+// Test 6: Check that kNN matches a brute-force scan
+TEST_F(SSTreeTest, KnnMatchesBruteForce) {
+  Point query = Point::random();
+  size_t k = 5;
+  std::vector<Data *> result = tree.knn(query, k);
+
+  std::vector<Data *> expected = data;
+  std::sort(expected.begin(), expected.end(), [&query](Data *a, Data *b) {
+      return a->getEmbedding().distance(query) <
+             b->getEmbedding().distance(query);
+  });
+  expected.resize(k);
+
+  ASSERT_EQ(result.size(), k);
+  for (size_t i = 0; i < k; ++i) {
+    EXPECT_EQ(result[i], expected[i]);
+  }
+}
+
+// Test 7: Check that a reused kNN context gives the same answers
+TEST_F(SSTreeTest, KnnContextReuse) {
+  SSKnnContext context;
+  std::vector<Data *> result;
+  for (size_t k: {1, 7, 3}) {
+    Point query = Point::random();
+    tree.knn(query, k, context, result);
+    EXPECT_EQ(result, tree.knn(query, k));
+  }
+}
+
+// Pairs within tau found by brute force, each pair ordered by pointer
+std::set<std::pair<Data *, Data *>>
+bruteForceJoin(const std::vector<Data *> &data, float tau) {
+  std::set<std::pair<Data *, Data *>> pairs;
+  for (size_t i = 0; i < data.size(); ++i) {
+    for (size_t j = i + 1; j < data.size(); ++j) {
+      if (Point::distance(data[i]->getEmbedding(),
+                          data[j]->getEmbedding()) <= tau) {
+        pairs.emplace(std::min(data[i], data[j]), std::max(data[i], data[j]));
+      }
+    }
+  }
+  return pairs;
+}
+
+std::set<std::pair<Data *, Data *>>
+normalizePairs(const std::vector<std::pair<Data *, Data *>> &found) {
+  std::set<std::pair<Data *, Data *>> pairs;
+  for (const auto &[a, b]: found) {
+    pairs.emplace(std::min(a, b), std::max(a, b));
+  }
+  return pairs;
+}
+
+class SSTreeJoinTest : public ::testing::Test {
+protected:
+    SSTree tree{MAX_POINTS_PER_NODE};
+    std::vector<Data *> data;
+
+    void SetUp() override {
+      data = generateRandomData(300);
+      // Near-duplicates of the first 20 entries
+      for (size_t i = 0; i < 20; ++i) {
+        Point copy = data[i]->getEmbedding() + Point::random(-0.01f, 0.01f);
+        data.push_back(new Data(copy, "dup_" + std::to_string(i) + ".jpg"));
+      }
+      for (const auto &d: data) {
+        tree.insert(d);
+      }
+    }
+
+    void TearDown() override {
+      for (auto &d: data) {
+        delete d;
+      }
+    }
+};
+
+// Test 8: Check that the self-join finds exactly the near-duplicates
+TEST_F(SSTreeJoinTest, FindsNearDuplicates) {
+  auto found = tree.selfJoin(1.0f, 4);
+  EXPECT_EQ(found.size(), 20u);
+  EXPECT_EQ(normalizePairs(found), bruteForceJoin(data, 1.0f));
+
+  auto paths = tree.nearDuplicates(1.0f, 4);
+  ASSERT_EQ(paths.size(), 20u);
+  for (const auto &[a, b]: paths) {
+    EXPECT_TRUE(a.rfind("dup_", 0) == 0 || b.rfind("dup_", 0) == 0);
+  }
+}
+
+// Test 9: Check the self-join against brute force with a loose threshold
+TEST_F(SSTreeJoinTest, MatchesBruteForce) {
+  float tau = 10.9f;
+  auto found = tree.selfJoin(tau, 3);
+  auto expected = bruteForceJoin(data, tau);
+  EXPECT_EQ(found.size(), expected.size());
+  EXPECT_EQ(normalizePairs(found), expected);
+}
+
+class SSTreeReinsertTest : public ::testing::Test {
+protected:
+    SSTree tree{MAX_POINTS_PER_NODE, 0.3f};
+    std::vector<Data *> data;
+
+    void SetUp() override {
+      data = generateRandomData(500);
+      for (const auto &d: data) {
+        tree.insert(d);
+      }
+    }
+
+    void TearDown() override {
+      for (auto &d: data) {
+        delete d;
+      }
+    }
+};
+
+// Test 10: Check the tree invariants with forced reinsertion enabled
+TEST_F(SSTreeReinsertTest, KeepsInvariants) {
+  std::unordered_set<Data *> treeData;
+  collectDataDFS(tree.getRoot(), treeData);
+  EXPECT_EQ(treeData, std::unordered_set<Data *>(data.begin(), data.end()));
+
+  int leafLevel = -1;
+  EXPECT_TRUE(leavesAtSameLevelDFS(tree.getRoot(), 0, leafLevel));
+  EXPECT_TRUE(
+          noNodeExceedsMaxChildrenDFS(tree.getRoot(), MAX_POINTS_PER_NODE));
+  EXPECT_TRUE(sphereCoversAllPoints(tree.getRoot()));
+}
+
+// Test 11: Check the quality statistics against a manual count
+TEST_F(SSTreeReinsertTest, QualityCountsNodes) {
+  SSTreeQuality stats = tree.quality();
+
+  size_t nodes = 0, leaves = 0;
+  std::vector<SSNode *> stack = {tree.getRoot()};
+  while (!stack.empty()) {
+    SSNode *node = stack.back();
+    stack.pop_back();
+    nodes++;
+    leaves += node->getIsLeaf();
+    for (SSNode *child: node->getChildren()) {
+      stack.push_back(child);
+    }
+  }
+
+  int leafLevel = -1;
+  leavesAtSameLevelDFS(tree.getRoot(), 1, leafLevel);
+  EXPECT_EQ(stats.nodeCount, nodes);
+  EXPECT_EQ(stats.leafCount, leaves);
+  EXPECT_EQ(stats.height, static_cast<size_t>(leafLevel));
+  EXPECT_GT(stats.meanRadius, 0.0);
+  EXPECT_GE(stats.siblingOverlap, 0.0);
+}
+
+// Test 12: Check that minimum enclosing spheres cover their entries and are
+// never looser than centroid spheres over the same tree shape
+TEST(SSTreeSphereModeTest, MinimumEnclosingSpheres) {
+  std::vector<Data *> data = generateRandomData(500);
+  SSTree centroidTree(MAX_POINTS_PER_NODE, 0.0f, CENTROID_SPHERE);
+  SSTree enclosingTree(MAX_POINTS_PER_NODE, 0.0f, MIN_ENCLOSING_SPHERE);
+  for (const auto &d: data) {
+    centroidTree.insert(d);
+    enclosingTree.insert(d);
+  }
+
+  EXPECT_TRUE(sphereCoversAllPoints(enclosingTree.getRoot()));
+  EXPECT_TRUE(sphereCoversAllChildrenSpheres(enclosingTree.getRoot()));
+  EXPECT_LE(enclosingTree.quality().meanRadius,
+            centroidTree.quality().meanRadius);
+
+  Point query = Point::random();
+  EXPECT_EQ(enclosingTree.knn(query, 5), centroidTree.knn(query, 5));
+
+  for (auto &d: data) {
+    delete d;
+  }
+}
+
+class ShardedSSTreeTest : public ::testing::TestWithParam<ShardPolicy> {
+protected:
+    ShardedSSTree index{4, MAX_POINTS_PER_NODE, GetParam()};
+    std::vector<Data *> data;
+
+    void SetUp() override {
+      data = generateRandomData(400);
+      if (GetParam() == CLUSTER_SHARDING) {
+        std::vector<Point> centroids;
+        for (size_t i = 0; i < index.numShards(); ++i) {
+          centroids.push_back(data[i]->getEmbedding());
+        }
+        index.setRoutingCentroids(centroids);
+      }
+      // Half one by one, half as a batch
+      for (size_t i = 0; i < data.size() / 2; ++i) {
+        index.insert(data[i]);
+      }
+      index.insert(std::vector<Data *>(data.begin() + data.size() / 2,
+                                       data.end()));
+    }
+
+    void TearDown() override {
+      for (auto &d: data) {
+        delete d;
+      }
+    }
+};
+
+// Test 13: Check that every entry lives in exactly its owning shard
+TEST_P(ShardedSSTreeTest, AllDataInOwningShard) {
+  index.flush();
+  EXPECT_EQ(index.size(), data.size());
+
+  std::unordered_set<Data *> seen;
+  for (size_t shard = 0; shard < index.numShards(); ++shard) {
+    std::unordered_set<Data *> shardData;
+    if (index.getShard(shard).getRoot()) {
+      collectDataDFS(index.getShard(shard).getRoot(), shardData);
+    }
+    for (Data *d: shardData) {
+      EXPECT_EQ(index.shardFor(d), shard);
+      EXPECT_TRUE(seen.insert(d).second);
+    }
+  }
+  EXPECT_EQ(seen.size(), data.size());
+}
+
+TEST_P(ShardedSSTreeTest, DuplicatesAreNotCounted) {
+  index.insert(data[0]);
+  index.insert(std::vector<Data *>(data.begin(), data.begin() + 10));
+  index.flush();
+  EXPECT_EQ(index.size(), data.size());
+}
+
+// Test 14: Check that the merged kNN matches a brute-force scan
+TEST_P(ShardedSSTreeTest, KnnMatchesBruteForce) {
+  Point query = Point::random();
+  size_t k = 8;
+  std::vector<Data *> result = index.knn(query, k);
+
+  std::vector<Data *> expected = data;
+  std::sort(expected.begin(), expected.end(), [&query](Data *a, Data *b) {
+      return a->getEmbedding().distance(query) <
+             b->getEmbedding().distance(query);
+  });
+  expected.resize(k);
+  EXPECT_EQ(result, expected);
+}
+
+INSTANTIATE_TEST_SUITE_P(Policies, ShardedSSTreeTest,
+                         ::testing::Values(HASH_SHARDING, CLUSTER_SHARDING));
+
+// Test 15: Check that the intra-query parallel kNN matches the serial one
+TEST(SSTreeParallelKnnTest, MatchesSerialKnn) {
+  std::vector<Data *> data = generateRandomData(1000);
+  SSTree tree(MAX_POINTS_PER_NODE);
+  for (const auto &d: data) {
+    tree.insert(d);
+  }
+
+  for (size_t k: {1, 10, 50}) {
+    for (size_t threads: {1, 3, 8}) {
+      Point query = Point::random();
+      EXPECT_EQ(tree.parallelKnn(query, k, threads), tree.knn(query, k));
+    }
+  }
+
+  for (auto &d: data) {
+    delete d;
+  }
+}
+
+// Checks that paged results rank like the in-memory ones. Entries at nearly
+// the same distance may come back in either order, so only the distances
+// are compared, with a float tolerance.
+void expectSameNeighbors(const Point &query, const std::vector<Data> &found,
+                         const std::vector<Data *> &expected) {
+  ASSERT_EQ(found.size(), expected.size());
+  for (size_t i = 0; i < found.size(); ++i) {
+    float distance = Point::distance(query, expected[i]->getEmbedding());
+    EXPECT_NEAR(Point::distance(query, found[i].getEmbedding()), distance,
+                1e-5f * distance);
+  }
+}
+
+// Test 16: Check that the paged tree answers like the in-memory one and
+// counts its page accesses
+class PagedSSTreeTest : public ::testing::Test {
+protected:
+    std::vector<Data *> data;
+    SSTree tree{MAX_POINTS_PER_NODE};
+    std::string path = (std::filesystem::temp_directory_path() /
+                        "sstree_pages.bin").string();
+
+    void SetUp() override {
+      data = generateRandomData(1000);
+      for (const auto &d: data) {
+        tree.insert(d);
+      }
+    }
+
+    void TearDown() override {
+      for (auto &d: data) {
+        delete d;
+      }
+      std::filesystem::remove(path);
+    }
+};
+
+TEST_F(PagedSSTreeTest, KnnMatchesInMemoryTree) {
+  PagedSSTree paged(tree, path, 4);
+  ASSERT_EQ(paged.size(), data.size());
+
+  for (size_t k: {1, 10, 50}) {
+    Point query = Point::random();
+    expectSameNeighbors(query, paged.knn(query, k), tree.knn(query, k));
+  }
+
+  BufferPoolStats stats = paged.getStats();
+  EXPECT_GT(stats.misses, 0);
+  EXPECT_GT(stats.evictions, 0);
+}
+
+TEST_F(PagedSSTreeTest, RepeatedQueryHitsThePool) {
+  PagedSSTree paged(tree, path, 1024, 0);
+  Point query = Point::random();
+  paged.knn(query, 10);
+  BufferPoolStats first = paged.getStats();
+  EXPECT_EQ(first.hits, 0);
+  EXPECT_EQ(first.readAheads, 0);
+
+  paged.resetStats();
+  paged.knn(query, 10);
+  BufferPoolStats second = paged.getStats();
+  EXPECT_EQ(second.misses, 0);
+  EXPECT_EQ(second.hits, first.misses);
+}
+
+TEST_F(PagedSSTreeTest, ConcurrentQueriesMatchSerial) {
+  PagedSSTree paged(tree, path, 8, 2);
+  std::vector<Point> queries;
+  for (size_t i = 0; i < 64; ++i) {
+    queries.push_back(Point::random());
+  }
+
+  std::vector<std::vector<Data>> found(queries.size());
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < 4; ++t) {
+    workers.emplace_back([&, t]() {
+        for (size_t q = t; q < queries.size(); q += 4) {
+          found[q] = paged.knn(queries[q], 10);
+        }
+    });
+  }
+  for (auto &worker: workers) {
+    worker.join();
+  }
+
+  for (size_t q = 0; q < queries.size(); ++q) {
+    expectSameNeighbors(queries[q], found[q], tree.knn(queries[q], 10));
+  }
+}
+
+// Test 17: Check that removed entries leave the tree and its invariants
+TEST_F(SSTreeReinsertTest, RemoveKeepsInvariants) {
+  for (size_t i = 0; i < data.size(); i += 2) {
+    ASSERT_TRUE(tree.remove(data[i]));
+  }
+  EXPECT_FALSE(tree.remove(data[0]));
+
+  std::unordered_set<Data *> treeData;
+  collectDataDFS(tree.getRoot(), treeData);
+  EXPECT_EQ(treeData.size(), data.size() / 2);
+  for (size_t i = 0; i < data.size(); ++i) {
+    EXPECT_EQ(treeData.count(data[i]), i % 2);
+  }
+  int leafLevel = -1;
+  EXPECT_TRUE(leavesAtSameLevelDFS(tree.getRoot(), 0, leafLevel));
+  EXPECT_TRUE(sphereCoversAllPoints(tree.getRoot()));
+  EXPECT_TRUE(sphereCoversAllChildrenSpheres(tree.getRoot()));
+
+  for (size_t i = 1; i < data.size(); i += 2) {
+    ASSERT_TRUE(tree.remove(data[i]));
+  }
+  EXPECT_EQ(tree.getRoot(), nullptr);
+}
+
+// Test 18: Check that a persisted tree recovers from its snapshot and log
+class DurableSSTreeTest : public ::testing::Test {
+protected:
+    std::vector<Data *> data;
+    std::filesystem::path directory = std::filesystem::temp_directory_path() /
+                                      "durable_sstree_test";
+
+    void SetUp() override {
+      std::filesystem::remove_all(directory);
+      data = generateRandomData(300);
+    }
+
+    void TearDown() override {
+      for (auto &d: data) {
+        delete d;
+      }
+      std::filesystem::remove_all(directory);
+    }
+
+    // Checks that the tree holds exactly the entries of data[from, to)
+    void expectEntries(DurableSSTree &tree, size_t from, size_t to) {
+      ASSERT_EQ(tree.size(), to - from);
+      for (size_t i = from; i < to; i += 37) {
+        std::vector<Data *> found = tree.knn(data[i]->getEmbedding(), 1);
+        ASSERT_EQ(found.size(), 1);
+        EXPECT_EQ(found[0]->getPath(), data[i]->getPath());
+      }
+    }
+};
+
+TEST_F(DurableSSTreeTest, ReplaysLogOnReopen) {
+  {
+    DurableSSTree tree(directory.string(), MAX_POINTS_PER_NODE, 16);
+    for (const auto &d: data) {
+      tree.insert(d->getEmbedding(), d->getPath());
+    }
+    for (size_t i = 0; i < 50; ++i) {
+      EXPECT_TRUE(tree.remove(data[i]->getPath()));
+    }
+    EXPECT_FALSE(tree.remove("missing.jpg"));
+  }
+
+  DurableSSTree reopened(directory.string(), MAX_POINTS_PER_NODE, 16);
+  expectEntries(reopened, 50, data.size());
+}
+
+TEST_F(DurableSSTreeTest, IgnoresTornTail) {
+  {
+    DurableSSTree tree(directory.string());
+    for (size_t i = 0; i < 100; ++i) {
+      tree.insert(data[i]->getEmbedding(), data[i]->getPath());
+    }
+  }
+  {
+    // A crash in the middle of a group leaves a partial record
+    std::ofstream log(directory / "wal.0", std::ios::binary | std::ios::app);
+    log << "torn";
+  }
+  {
+    DurableSSTree tree(directory.string());
+    expectEntries(tree, 0, 100);
+    for (size_t i = 100; i < 200; ++i) {
+      tree.insert(data[i]->getEmbedding(), data[i]->getPath());
+    }
+  }
+
+  DurableSSTree reopened(directory.string());
+  expectEntries(reopened, 0, 200);
+}
+
+TEST_F(DurableSSTreeTest, CompactionFoldsLogIntoSnapshot) {
+  {
+    DurableSSTree tree(directory.string());
+    for (size_t i = 0; i < 200; ++i) {
+      tree.insert(data[i]->getEmbedding(), data[i]->getPath());
+    }
+    tree.compact();
+    for (size_t i = 200; i < data.size(); ++i) {
+      tree.insert(data[i]->getEmbedding(), data[i]->getPath());
+    }
+    tree.remove(data[0]->getPath());
+    tree.waitForCompaction();
+    EXPECT_EQ(tree.getGeneration(), 1);
+    EXPECT_FALSE(std::filesystem::exists(directory / "wal.0"));
+    EXPECT_TRUE(std::filesystem::exists(directory / "snapshot.1"));
+  }
+
+  DurableSSTree reopened(directory.string());
+  expectEntries(reopened, 1, data.size());
+}
+
+TEST_F(DurableSSTreeTest, ReportsFailedCompaction) {
+  {
+    DurableSSTree tree(directory.string());
+    for (size_t i = 0; i < 100; ++i) {
+      tree.insert(data[i]->getEmbedding(), data[i]->getPath());
+    }
+    // The snapshot cannot be created over a directory
+    std::filesystem::create_directory(directory / "snapshot.1.tmp");
+    tree.compact();
+    EXPECT_THROW(tree.waitForCompaction(), std::runtime_error);
+    EXPECT_NO_THROW(tree.waitForCompaction());
+    EXPECT_TRUE(std::filesystem::exists(directory / "wal.0"));
+    EXPECT_FALSE(std::filesystem::exists(directory / "snapshot.1"));
+  }
+
+  DurableSSTree reopened(directory.string());
+  expectEntries(reopened, 0, 100);
+}
+
+TEST_F(DurableSSTreeTest, SkipsUnrelatedFiles) {
+  {
+    DurableSSTree tree(directory.string());
+    for (size_t i = 0; i < 100; ++i) {
+      tree.insert(data[i]->getEmbedding(), data[i]->getPath());
+    }
+  }
+  for (const char *name: {"wal.bak", "snapshot.1x", "snapshot.",
+                          "snapshot.3.tmp", "wal.99999999999999999999"}) {
+    std::ofstream(directory / name) << "junk";
+  }
+
+  DurableSSTree reopened(directory.string());
+  expectEntries(reopened, 0, 100);
+  EXPECT_FALSE(std::filesystem::exists(directory / "snapshot.3.tmp"));
+  EXPECT_TRUE(std::filesystem::exists(directory / "wal.bak"));
+  EXPECT_TRUE(std::filesystem::exists(directory / "snapshot.1x"));
+}
+
+// Test 19: Check that fvecs and npy files stream into the tree unchanged
+class EmbeddingReaderTest : public ::testing::Test {
+protected:
+    std::vector<Data *> data;
+    std::filesystem::path directory = std::filesystem::temp_directory_path() /
+                                      "embedding_reader_test";
+
+    void SetUp() override {
+      std::filesystem::create_directories(directory);
+      data = generateRandomData(250);
+
+      std::ofstream fvecs(directory / "embeddings.fvecs", std::ios::binary);
+      std::ofstream paths(directory / "paths.txt");
+      for (const auto &d: data) {
+        auto dimension = static_cast<int32_t>(DIM);
+        fvecs.write(reinterpret_cast<const char *>(&dimension),
+                    sizeof(dimension));
+        fvecs.write(reinterpret_cast<const char *>(d->getEmbedding().data()),
+                    DIM * sizeof(float));
+        paths << d->getPath() << "\n";
+      }
+
+      std::string header = "{'descr': '<f4', 'fortran_order': False, "
+                           "'shape': (" + std::to_string(data.size()) + ", " +
+                           std::to_string(DIM) + "), }";
+      header.append(63 - (10 + header.size()) % 64, ' ');
+      header += '\n';
+      auto length = static_cast<uint16_t>(header.size());
+      std::ofstream npy(directory / "embeddings.npy", std::ios::binary);
+      npy.write("\x93NUMPY\x01\x00", 8);
+      npy.write(reinterpret_cast<const char *>(&length), sizeof(length));
+      npy << header;
+      for (const auto &d: data) {
+        npy.write(reinterpret_cast<const char *>(d->getEmbedding().data()),
+                  DIM * sizeof(float));
+      }
+    }
+
+    void TearDown() override {
+      for (auto &d: data) {
+        delete d;
+      }
+      std::filesystem::remove_all(directory);
+    }
+
+    void expectSameData(const std::vector<Data *> &loaded, bool withPaths) {
+      ASSERT_EQ(loaded.size(), data.size());
+      for (size_t i = 0; i < data.size(); ++i) {
+        EXPECT_EQ(loaded[i]->getPath(),
+                  withPaths ? data[i]->getPath() : std::to_string(i));
+        EXPECT_EQ(Point::distance(loaded[i]->getEmbedding(),
+                                  data[i]->getEmbedding()), 0.0f);
+      }
+    }
+};
+
+TEST_F(EmbeddingReaderTest, StreamsFvecsIntoTree) {
+  EmbeddingReader reader((directory / "embeddings.fvecs").string(),
+                         (directory / "paths.txt").string());
+  EXPECT_EQ(reader.getFormat(), FVECS);
+  EXPECT_EQ(reader.size(), data.size());
+
+  SSTree tree(MAX_POINTS_PER_NODE);
+  std::vector<Data *> loaded = reader.ingest(tree, 64);
+  EXPECT_EQ(reader.remaining(), 0);
+  expectSameData(loaded, true);
+
+  std::unordered_set<Data *> treeData;
+  collectDataDFS(tree.getRoot(), treeData);
+  EXPECT_EQ(treeData, std::unordered_set<Data *>(loaded.begin(), loaded.end()));
+  for (auto &d: loaded) {
+    delete d;
+  }
+}
+
+TEST_F(EmbeddingReaderTest, ReadsNpyInBoundedBatches) {
+  EmbeddingReader reader((directory / "embeddings.npy").string());
+  EXPECT_EQ(reader.getFormat(), NPY);
+
+  std::vector<Data *> loaded;
+  std::vector<std::unique_ptr<Data>> batch;
+  while (reader.next(batch, 100)) {
+    EXPECT_LE(batch.size(), 100);
+    for (auto &d: batch) {
+      loaded.push_back(d.release());
+    }
+  }
+  expectSameData(loaded, false);
+  for (auto &d: loaded) {
+    delete d;
+  }
+}
+
+TEST_F(EmbeddingReaderTest, BulkLoadsPagedTree) {
+  EmbeddingReader reader((directory / "embeddings.fvecs").string(),
+                         (directory / "paths.txt").string());
+  std::string path = (directory / "pages.bin").string();
+  PagedSSTree paged(reader, path, 8, MAX_POINTS_PER_NODE, 64);
+  EXPECT_EQ(reader.remaining(), 0);
+  ASSERT_EQ(paged.size(), data.size());
+  // Four leaves for each batch of 64 and three for the last 58 entries
+  EXPECT_EQ(paged.getNumPages(), 15);
+
+  SSTree tree(MAX_POINTS_PER_NODE);
+  for (const auto &d: data) {
+    tree.insert(d);
+  }
+  for (size_t k: {1, 10, 50}) {
+    Point query = Point::random();
+    expectSameNeighbors(query, paged.knn(query, k), tree.knn(query, k));
+  }
+}
+
+TEST_F(EmbeddingReaderTest, BulkLoadRejectsShortPathList) {
+  {
+    std::ofstream paths(directory / "short.txt");
+    for (size_t i = 0; i < 100; ++i) {
+      paths << data[i]->getPath() << "\n";
+    }
+  }
+  EmbeddingReader reader((directory / "embeddings.fvecs").string(),
+                         (directory / "short.txt").string());
+  EXPECT_THROW(PagedSSTree(reader, (directory / "pages.bin").string(), 8,
+                           MAX_POINTS_PER_NODE, 64),
+               std::runtime_error);
+}
+
+TEST_F(EmbeddingReaderTest, IngestUndoesPartialLoad) {
+  {
+    std::ofstream paths(directory / "short.txt");
+    for (size_t i = 0; i < 100; ++i) {
+      paths << data[i]->getPath() << "\n";
+    }
+  }
+  EmbeddingReader reader((directory / "embeddings.fvecs").string(),
+                         (directory / "short.txt").string());
+  SSTree tree(MAX_POINTS_PER_NODE);
+  EXPECT_THROW(reader.ingest(tree, 64), std::runtime_error);
+
+  std::unordered_set<Data *> treeData;
+  if (tree.getRoot()) {
+    collectDataDFS(tree.getRoot(), treeData);
+  }
+  EXPECT_TRUE(treeData.empty());
+}
+
+TEST_F(EmbeddingReaderTest, RejectsWrongDimension) {
+  std::ofstream fvecs(directory / "small.fvecs", std::ios::binary);
+  std::vector<float> vector(DIM / 2 + 1, 1.0f);
+  auto dimension = static_cast<int32_t>(vector.size() - 1);
+  for (size_t i = 0; i < 2; ++i) {
+    fvecs.write(reinterpret_cast<const char *>(&dimension), sizeof(dimension));
+    fvecs.write(reinterpret_cast<const char *>(vector.data()),
+                dimension * sizeof(float));
+  }
+  fvecs.close();
+  EXPECT_THROW(EmbeddingReader((directory / "small.fvecs").string()),
+               std::runtime_error);
+  EXPECT_THROW(EmbeddingReader((directory / "paths.txt").string()),
+               std::invalid_argument);
+}
+
+// Test 20: Check that filtered kNN matches brute force over the matches
+TEST(SSTreeFilterTest, FilteredKnnMatchesBruteForce) {
+  std::vector<Data *> data;
+  for (size_t i = 0; i < 1000; ++i) {
+    data.push_back(new Data(Point::random(), "eda_" + std::to_string(i) + ".jpg",
+                            static_cast<uint32_t>(i % 7),
+                            static_cast<int64_t>(i)));
+  }
+  SSTree tree(MAX_POINTS_PER_NODE);
+  for (const auto &d: data) {
+    tree.insert(d);
+  }
+
+  KnnFilter filter;
+  filter.categories = {2, 5};
+  filter.minTimestamp = 300;
+  std::vector<Data *> matching;
+  for (const auto &d: data) {
+    if (filter.matches(*d)) {
+      matching.push_back(d);
+    }
+  }
+
+  Point query = Point::random();
+  std::vector<Data *> found = tree.knn(query, 20, filter);
+  std::sort(matching.begin(), matching.end(), [&query](Data *a, Data *b) {
+      return a->getEmbedding().distance(query) <
+             b->getEmbedding().distance(query);
+  });
+  EXPECT_EQ(found, std::vector<Data *>(matching.begin(), matching.begin() + 20));
+
+  // Fewer matches than k: every match is returned
+  filter.maxTimestamp = 330;
+  found = tree.knn(query, 20, filter);
+  EXPECT_EQ(found.size(), 8);
+  for (const auto &d: found) {
+    EXPECT_TRUE(filter.matches(*d));
+  }
+
+  filter.categories = {5};
+  filter.maxTimestamp = 302;
+  EXPECT_TRUE(tree.knn(query, 5, filter).empty());
+
+  for (auto &d: data) {
+    delete d;
+  }
+}
+
+// Test 21: Check that cached results stay exact across hits and updates
+TEST_F(SSTreeTest, QueryCacheHitsAndInvalidates) {
+  KnnQueryCache cache(tree, 2);
+  Point query = Point::random();
+  std::vector<Data *> expected = tree.knn(query, 5);
+
+  EXPECT_EQ(cache.knn(query, 5), expected);
+  EXPECT_EQ(cache.knn(query, 5), expected);
+  QueryCacheStats stats = cache.getStats();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.entries, 1);
+  EXPECT_GT(stats.memoryBytes, DIM * sizeof(float));
+
+  // An insert makes the cached entry stale
+  Data *closest = new Data(query, "closest.jpg");
+  tree.insert(closest);
+  std::vector<Data *> updated = cache.knn(query, 5);
+  EXPECT_EQ(updated.front(), closest);
+  EXPECT_EQ(cache.getStats().stale, 1);
+
+  // A near-identical query shares the bucket but must not hit, nor evict
+  // the cached query
+  Point nearby = query;
+  nearby[0] += 1e-7f;
+  cache.knn(nearby, 5);
+  EXPECT_EQ(cache.getStats().hits, 1);
+  EXPECT_EQ(cache.getStats().entries, 2);
+  cache.knn(query, 5);
+  cache.knn(nearby, 5);
+  EXPECT_EQ(cache.getStats().hits, 3);
+
+  // Capacity bounds the entries
+  cache.knn(Point::random(), 5);
+  cache.knn(Point::random(), 5);
+  EXPECT_EQ(cache.getStats().entries, 2);
+  EXPECT_DOUBLE_EQ(cache.getStats().hitRate(), 3.0 / 8.0);
+
+  // Huge coordinates still hash and cache; non-finite ones only go
+  // through the hash with k = 0, which never reaches the tree
+  Point huge = query;
+  huge[0] = std::numeric_limits<float>::max();
+  huge[1] = std::numeric_limits<float>::lowest();
+  cache.knn(huge, 5);
+  EXPECT_EQ(cache.knn(huge, 5), tree.knn(huge, 5));
+  Point nonFinite = query;
+  nonFinite[0] = std::numeric_limits<float>::infinity();
+  nonFinite[1] = std::numeric_limits<float>::quiet_NaN();
+  cache.knn(nonFinite, 0);
+  EXPECT_TRUE(cache.knn(nonFinite, 0).empty());
+  EXPECT_EQ(cache.getStats().hits, 5);
+
+  tree.remove(closest);
+  delete closest;
+}
+
 /*
  * Main Function for Google Test
  */
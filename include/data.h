@@ -1,22 +1,45 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
+#include <algorithm>
 #include "point.h"
 
+// Bit of a category in the per-node summaries; categories from 63 up share
+// the last bit
+inline uint64_t categoryBit(uint32_t category) {
+  return uint64_t(1) << std::min<uint32_t>(category, 63);
+}
+
 class Data {
 private:
     Point embedding;
     std::string path;
+    // Metadata columns, fixed at construction so node summaries stay valid
+    uint32_t category = 0;
+    int64_t timestamp = 0;
 
 public:
     Data(const Point &embedding, const std::string &imagePath)
             : embedding(embedding), path(imagePath) {}
 
+    Data(Point &&embedding, std::string imagePath)
+            : embedding(std::move(embedding)), path(std::move(imagePath)) {}
+
+    Data(const Point &embedding, const std::string &imagePath,
+         uint32_t category, int64_t timestamp)
+            : embedding(embedding), path(imagePath), category(category),
+              timestamp(timestamp) {}
+
     // Getters
     const Point &getEmbedding() const { return embedding; }
 
     const std::string &getPath() const { return path; }
 
+    uint32_t getCategory() const { return category; }
+
+    int64_t getTimestamp() const { return timestamp; }
+
     // Operators
     bool operator==(const Data &other) const {
       return path == other.path;
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <cstdio>
+#include <cstdint>
+#include <filesystem>
+#include <unordered_map>
+#include "sstree.h"
+
+/**
+ * DurableSSTree
+ * SSTree persisted as a snapshot plus an append-only write-ahead log. Every
+ * insert and remove is applied to the in-memory tree and appended to the
+ * log; records are written and synced in groups of groupCommitSize (or on
+ * commit()), so ingestion costs one sequential write per group and a change
+ * is durable once its group is committed. Opening a directory loads the
+ * latest snapshot and replays the logs written after it, stopping at the
+ * first torn or corrupt record. compact() folds the log into a new snapshot
+ * on a background thread while new records go to a fresh log.
+ *
+ * Files for generation g: snapshot.g holds the live entries when g started
+ * (there is none for g = 0) and wal.g the records appended since then.
+ */
+class DurableSSTree {
+private:
+    std::filesystem::path directory;
+    size_t groupCommitSize;
+    SSTree tree;
+    // Shared so a compaction can still encode entries removed after it started
+    std::unordered_map<std::string, std::shared_ptr<Data>> live;
+
+    mutable std::mutex lock;
+    std::FILE *log = nullptr;
+    uint64_t generation = 0;
+    std::vector<char> pending; // Encoded records of the open group
+    size_t pendingRecords = 0;
+    std::thread compaction;
+    std::exception_ptr compactionError; // Set by a failed compaction
+
+    void recover();
+
+    void openLog();
+
+    void writePending();
+
+    void applyInsert(const Point &embedding, const std::string &path);
+
+    bool applyRemove(const std::string &path);
+
+public:
+    explicit DurableSSTree(const std::string &directory,
+                           size_t maxPointsPerNode = 20,
+                           size_t groupCommitSize = 64);
+
+    // Commits the open group; call commit() first to see its errors
+    ~DurableSSTree();
+
+    DurableSSTree(const DurableSSTree &) = delete;
+
+    DurableSSTree &operator=(const DurableSSTree &) = delete;
+
+    // Inserting an existing path replaces its embedding
+    void insert(const Point &embedding, const std::string &path);
+
+    bool remove(const std::string &path);
+
+    // Writes and syncs the open group
+    void commit();
+
+    // Starts folding the log into a new snapshot in the background
+    void compact();
+
+    // Waits for the running compaction and rethrows its error, if any
+    void waitForCompaction();
+
+    // The returned Data stay valid until their path is removed or replaced
+    std::vector<Data *> knn(const Point &query, size_t k) const;
+
+    // Getters
+    size_t size() const;
+
+    uint64_t getGeneration() const;
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <cstdint>
+#include "data.h"
+#include "sstree.h"
+
+// Supported embedding file formats
+enum EmbeddingFormat {
+    FVECS, // Per vector: int32 dimension, then the float32 coordinates
+    NPY    // NumPy array of shape (N, DIM), little-endian float32, C order
+};
+
+/**
+ * EmbeddingReader
+ * Streams the vectors of a memory-mapped .fvecs or .npy file as Data, in
+ * batches of bounded size. The dimension is checked against DIM when the
+ * file is opened. Each vector is copied once, straight from the mapping
+ * into the Point of its Data, and the mapped pages of a batch are released
+ * once the batch has been handed out, so memory use stays bounded by the
+ * batch size rather than the file size.
+ * Paths come from an optional text file with one path or id per line, in the
+ * same order as the vectors; without it, the vector index is used.
+ */
+class EmbeddingReader {
+private:
+    EmbeddingFormat format;
+    const char *mapping = nullptr;
+    size_t mappingSize = 0;
+    const char *vectors = nullptr; // First vector
+    size_t stride = 0;             // Bytes between consecutive vectors
+    size_t count = 0;
+    size_t position = 0;
+    size_t released = 0;           // Bytes of the mapping already released
+    std::ifstream paths;
+
+    void parseFvecs();
+
+    void parseNpy();
+
+public:
+    explicit EmbeddingReader(const std::string &embeddingsPath,
+                             const std::string &pathsFile = "");
+
+    ~EmbeddingReader();
+
+    EmbeddingReader(const EmbeddingReader &) = delete;
+
+    EmbeddingReader &operator=(const EmbeddingReader &) = delete;
+
+    // Fills batch with up to batchSize new Data; false once the file is done
+    bool next(std::vector<std::unique_ptr<Data>> &batch, size_t batchSize);
+
+    // Inserts the remaining vectors into tree; the caller owns the new Data
+    std::vector<Data *> ingest(SSTree &tree, size_t batchSize = 4096);
+
+    // Getters
+    EmbeddingFormat getFormat() const { return format; }
+
+    size_t size() const { return count; }
+
+    size_t remaining() const { return count - position; }
+};
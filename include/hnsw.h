@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <limits>
+#include <cstdint>
+#include "point.h"
+#include "data.h"
+
+/**
+ * HNSW
+ * Hierarchical Navigable Small World graph index over Data embeddings.
+ * Exposes the same knn(query, k) signature as SSTree so both indexes can be
+ * swapped and compared. build() links entries from several threads; insert()
+ * and knn() must not run concurrently with each other.
+ */
+class HNSW {
+private:
+    struct Node {
+        Data *data;
+        size_t level;
+        std::vector<std::vector<uint32_t>> neighbors; // One list per layer
+        std::mutex lock;
+
+        Node(Data *data, size_t level)
+                : data(data), level(level), neighbors(level + 1) {}
+    };
+
+    using Candidate = std::pair<float, uint32_t>;
+
+    size_t M;
+    size_t maxM0;
+    size_t efConstruction;
+    size_t efSearch;
+    double levelMultiplier;
+
+    std::vector<std::unique_ptr<Node>> nodes;
+    uint32_t entryPoint;
+    size_t maxLevel;
+    std::mutex globalLock;
+    std::mt19937 levelGenerator;
+
+    size_t randomLevel();
+
+    float distance(const Point &query, uint32_t id) const;
+
+    uint32_t addNode(Data *_data);
+
+    void link(uint32_t id);
+
+    uint32_t greedyClosest(const Point &query, uint32_t entry,
+                           size_t fromLevel, size_t toLevel) const;
+
+    std::vector<Candidate> searchLayer(const Point &query, uint32_t entry,
+                                       size_t ef, size_t layer) const;
+
+    std::vector<uint32_t> selectNeighbors(std::vector<Candidate> candidates,
+                                          size_t maxNeighbors) const;
+
+    size_t maxNeighbors(size_t layer) const {
+      return layer == 0 ? maxM0 : M;
+    }
+
+public:
+    static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+    explicit HNSW(size_t M = 16, size_t efConstruction = 200,
+                  size_t efSearch = 50, unsigned seed = 42);
+
+    // Inserts a single entry
+    void insert(Data *_data);
+
+    // Inserts a batch of entries, linking them from numThreads threads
+    void build(const std::vector<Data *> &data, size_t numThreads);
+
+    std::vector<Data *> knn(Point &query, size_t k);
+
+    // Getters and setters
+    size_t size() const { return nodes.size(); }
+
+    size_t getMaxLevel() const { return maxLevel; }
+
+    size_t getEfSearch() const { return efSearch; }
+
+    void setEfSearch(size_t ef) { efSearch = ef; }
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+#include "point.h"
+#include "data.h"
+#include "knncontext.h"
+
+/**
+ * IVFIndex
+ * Inverted-file index: a k-means coarse quantizer splits the space into
+ * nlist cells, and each entry is stored in the list of its nearest centroid.
+ * Queries only scan the nprobe lists closest to the query. Embeddings are
+ * copied into each list contiguously so a scan streams through memory.
+ */
+class IVFIndex {
+private:
+    struct InvertedList {
+        std::vector<float> vectors; // DIM floats per entry, row after row
+        std::vector<Data *> entries;
+    };
+
+    size_t nlist;
+    size_t nprobe;
+    std::vector<Point> centroids;
+    std::vector<InvertedList> lists;
+
+    size_t nearestCentroid(const Point &point) const;
+
+    void append(size_t list, Data *_data);
+
+public:
+    using Context = KnnContext<float, Data *, InvertedList>;
+
+    explicit IVFIndex(size_t nlist, size_t nprobe = 1)
+            : nlist(nlist), nprobe(nprobe) {}
+
+    // Trains the centroids with k-means over a sample of the data
+    void train(const std::vector<Data *> &sample, size_t iterations = 10,
+               size_t numThreads = 0, unsigned seed = 42);
+
+    void insert(Data *_data);
+
+    // Inserts a batch, assigning entries to lists in parallel
+    void insert(const std::vector<Data *> &data, size_t numThreads = 0);
+
+    std::vector<Data *> knn(Point &query, size_t k);
+
+    void knn(const Point &query, size_t k, Context &context,
+             std::vector<Data *> &result) const;
+
+    // Getters and setters
+    bool isTrained() const { return !centroids.empty(); }
+
+    size_t size() const;
+
+    size_t getNlist() const { return nlist; }
+
+    size_t getNprobe() const { return nprobe; }
+
+    void setNprobe(size_t _nprobe) { nprobe = _nprobe; }
+
+    const std::vector<Point> &getCentroids() const { return centroids; }
+
+    const std::vector<Data *> &getList(size_t list) const {
+      return lists[list].entries;
+    }
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+/**
+ * KnnContext
+ * Scratch space for a kNN query: a bounded max-heap with the current top-k
+ * and the traversal frontier of pending nodes. Buffers keep their capacity
+ * across reset(), so a context reused between queries (passed by the caller
+ * or thread_local) allocates nothing once it has warmed up.
+ */
+template<typename Distance, typename Item, typename Node>
+class KnnContext {
+public:
+    using Entry = std::pair<Distance, Item>;
+    using Pending = std::pair<Distance, Node *>;
+
+private:
+    size_t k = 0;
+    std::vector<Entry> heap;       // Max-heap on distance, at most k entries
+    std::vector<Pending> frontier; // Stack or min-heap of nodes to visit
+
+    static bool closer(const Entry &a, const Entry &b) {
+      return a.first < b.first;
+    }
+
+    static bool farther(const Pending &a, const Pending &b) {
+      return b.first < a.first;
+    }
+
+public:
+    KnnContext() = default;
+
+    explicit KnnContext(size_t capacity) { reset(capacity); }
+
+    // Prepares the context for a new query with the given k
+    void reset(size_t _k) {
+      k = _k;
+      heap.clear();
+      frontier.clear();
+      heap.reserve(k);
+    }
+
+    // Top-k buffer
+    size_t getK() const { return k; }
+
+    size_t size() const { return heap.size(); }
+
+    bool full() const { return heap.size() >= k; }
+
+    // Distance of the current k-th best; only valid when size() > 0
+    const Distance &worst() const { return heap.front().first; }
+
+    /**
+     * offer
+     * Adds a candidate if there is room or it beats the current k-th best.
+     * @return bool: Returns true if the candidate was kept.
+     */
+    bool offer(const Distance &dist, const Item &item) {
+      if (heap.size() < k) {
+        heap.emplace_back(dist, item);
+        std::push_heap(heap.begin(), heap.end(), closer);
+        return true;
+      }
+      if (k == 0 || !(dist < heap.front().first)) {
+        return false;
+      }
+      std::pop_heap(heap.begin(), heap.end(), closer);
+      heap.back() = Entry(dist, item);
+      std::push_heap(heap.begin(), heap.end(), closer);
+      return true;
+    }
+
+    // Traversal frontier used as a LIFO stack (depth-first search)
+    void push(const Distance &bound, Node *node) {
+      frontier.emplace_back(bound, node);
+    }
+
+    Pending pop() {
+      Pending top = frontier.back();
+      frontier.pop_back();
+      return top;
+    }
+
+    // Traversal frontier used as a min-heap (best-first search)
+    void pushClosest(const Distance &bound, Node *node) {
+      frontier.emplace_back(bound, node);
+      std::push_heap(frontier.begin(), frontier.end(), farther);
+    }
+
+    Pending popClosest() {
+      std::pop_heap(frontier.begin(), frontier.end(), farther);
+      Pending top = frontier.back();
+      frontier.pop_back();
+      return top;
+    }
+
+    const Pending &peekClosest() const { return frontier.front(); }
+
+    bool hasPending() const { return !frontier.empty(); }
+
+    /**
+     * drain
+     * Writes the collected items into out, closest first, and empties the
+     * top-k buffer. out is cleared but keeps its capacity.
+     */
+    template<typename Out, typename Convert>
+    void drain(std::vector<Out> &out, Convert convert) {
+      std::sort_heap(heap.begin(), heap.end(), closer);
+      out.clear();
+      out.reserve(heap.size());
+      for (const auto &entry: heap) {
+        out.push_back(convert(entry.second));
+      }
+      heap.clear();
+    }
+
+    void drain(std::vector<Item> &out) {
+      drain(out, [](const Item &item) { return item; });
+    }
+
+    // Same, keeping the distance of each item
+    void drainEntries(std::vector<Entry> &out) {
+      std::sort_heap(heap.begin(), heap.end(), closer);
+      out.assign(heap.begin(), heap.end());
+      heap.clear();
+    }
+
+    // Direct access to the heap entries, in heap order
+    const std::vector<Entry> &getEntries() const { return heap; }
+};
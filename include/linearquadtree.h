@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "particlesystem.h"
+#include "knncontext.h"
+
+/**
+ * LinearQuadTree
+ * Quadtree stored as particles sorted by Morton code. Positions are
+ * quantized to a 2^16 x 2^16 grid over the root Rect and the x and y bits
+ * interleaved, so every quadtree node is a contiguous run of the sorted
+ * array sharing a code prefix. The tree is rebuilt from scratch each frame
+ * with a parallel radix sort instead of being updated in place.
+ */
+class LinearQuadTree {
+public:
+    using Index = ParticleSystem::Index;
+
+    static constexpr unsigned LEVELS = 16; // Bits per axis
+
+    /**
+     * Cell
+     * Node of the tree: the run [begin, end) of the sorted arrays whose
+     * codes share the cell's prefix, with the cell bounds and its children,
+     * which are stored next to each other.
+     */
+    struct Cell {
+        double xmin, ymin, xmax, ymax;
+        uint32_t begin, end;
+        uint32_t firstChild;
+        uint8_t numChildren;
+        uint8_t level;
+
+        bool isLeaf() const { return numChildren == 0; }
+    };
+
+private:
+    double xmin, ymin, width, height;
+    size_t leafSize;
+
+    std::vector<uint32_t> codes; // Sorted Morton codes
+    std::vector<Index> order;    // Particle of each sorted slot
+    std::vector<double> sortedX, sortedY;
+    std::vector<Cell> cells;     // cells[0] is the root
+
+    // Scratch buffers of the radix sort, kept across frames
+    std::vector<uint32_t> codeBuffer;
+    std::vector<Index> orderBuffer;
+
+    void radixSort(size_t numThreads);
+
+    void buildCells();
+
+public:
+    explicit LinearQuadTree(const Rect &boundary, size_t leafSize = 8);
+
+    // Re-indexes every particle of the system
+    void build(const ParticleSystem &system, size_t numThreads = 0);
+
+    uint32_t mortonCode(double x, double y) const;
+
+    std::vector<Index> knn(const Point2D &queryPoint, size_t k) const;
+
+    void knn(const Point2D &queryPoint, size_t k,
+             KnnContext<double, Index, const Cell> &context,
+             std::vector<Index> &result) const;
+
+    // Getters
+    size_t size() const { return order.size(); }
+
+    const std::vector<uint32_t> &getCodes() const { return codes; }
+
+    const std::vector<Index> &getOrder() const { return order; }
+
+    const std::vector<Cell> &getCells() const { return cells; }
+};
+
+using LinearKnnContext = KnnContext<double, ParticleSystem::Index,
+                                    const LinearQuadTree::Cell>;
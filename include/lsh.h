@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <Eigen/Dense>
+#include "point.h"
+#include "data.h"
+
+// Hash family used by the LSH index
+enum LSHFamily {
+    COSINE,   // Signed random projections
+    EUCLIDEAN // p-stable (Gaussian) projections with bucket width w
+};
+
+/**
+ * LSHIndex
+ * Locality-sensitive hashing index over Data embeddings. Each of the
+ * numTables tables hashes an embedding with numHashes random projections.
+ * Queries look up their own bucket and up to numProbes perturbed buckets per
+ * table (multi-probe), then re-rank the candidates by exact distance.
+ * Recall is approximate; the goal is millisecond near-duplicate lookups.
+ */
+class LSHIndex {
+private:
+    using Bucket = std::vector<Data *>;
+
+    LSHFamily family;
+    size_t numHashes;
+    float bucketWidth;
+    size_t numProbes;
+
+    std::vector<Eigen::MatrixXf> projections; // numHashes x DIM per table
+    std::vector<Eigen::VectorXf> offsets;     // EUCLIDEAN only
+    std::vector<std::unordered_map<uint64_t, Bucket>> tables;
+    size_t count = 0;
+
+    void hashValues(size_t table, const Point &point,
+                    std::vector<int64_t> &values,
+                    std::vector<float> &margins) const;
+
+    uint64_t key(const std::vector<int64_t> &values) const;
+
+    void probeKeys(const std::vector<int64_t> &values,
+                   const std::vector<float> &margins,
+                   std::vector<uint64_t> &keys) const;
+
+public:
+    LSHIndex(LSHFamily family, size_t numTables = 8, size_t numHashes = 12,
+             float bucketWidth = 4.0f, size_t numProbes = 0,
+             unsigned seed = 42);
+
+    void insert(Data *_data);
+
+    // Entries sharing a probed bucket with the query, without duplicates
+    std::vector<Data *> candidates(const Point &query) const;
+
+    // Approximate kNN: candidates re-ranked with Point::distance
+    std::vector<Data *> knn(Point &query, size_t k);
+
+    // Candidates whose exact distance to the query is at most radius
+    std::vector<Data *> nearDuplicates(const Point &query, float radius) const;
+
+    // Getters and setters
+    size_t size() const { return count; }
+
+    size_t getNumProbes() const { return numProbes; }
+
+    void setNumProbes(size_t probes) { numProbes = probes; }
+};
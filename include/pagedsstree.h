@@ -0,0 +1,144 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <fstream>
+#include <string>
+#include <cstdint>
+#include "sstree.h"
+#include "embeddingreader.h"
+
+// Longest image path a page slot can hold
+constexpr size_t PAGE_PATH_CAPACITY = 255;
+
+// Entries of one leaf, decoded from its page
+struct LeafPage {
+    std::vector<Data> entries;
+};
+
+using LeafPagePtr = std::shared_ptr<const LeafPage>;
+
+// Counters of a BufferPool
+struct BufferPoolStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t readAheads = 0; // Pages loaded before a query asked for them
+    size_t evictions = 0;
+};
+
+/**
+ * BufferPool
+ * LRU cache of decoded leaf pages read from a page file. Pages are handed
+ * out as shared pointers, so a page evicted while a query still holds it
+ * stays alive until the query drops it.
+ * Pages are read with pread outside the pool lock, so a miss only blocks
+ * the queries that wait for the same page: they share the one read in
+ * flight instead of issuing their own.
+ */
+class BufferPool {
+private:
+    mutable std::mutex lock;
+    int fd = -1;
+    size_t pageBytes;
+    size_t capacity;
+    // Most recently used first
+    std::list<std::pair<uint32_t, LeafPagePtr>> lru;
+    std::unordered_map<uint32_t, decltype(lru)::iterator> resident;
+    std::unordered_map<uint32_t, std::shared_future<LeafPagePtr>> inFlight;
+    BufferPoolStats stats;
+
+    LeafPagePtr readPage(uint32_t page) const;
+
+    LeafPagePtr load(uint32_t page, std::unique_lock<std::mutex> &guard);
+
+    void admit(uint32_t page, const LeafPagePtr &data);
+
+public:
+    BufferPool(const std::string &path, size_t pageBytes, size_t capacity);
+
+    ~BufferPool();
+
+    BufferPool(const BufferPool &) = delete;
+
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    LeafPagePtr fetch(uint32_t page);
+
+    // Loads the pages that are not resident yet as read-ahead
+    void prefetch(std::vector<uint32_t> pages);
+
+    bool isResident(uint32_t page) const;
+
+    // Getters
+    size_t getCapacity() const { return capacity; }
+
+    BufferPoolStats getStats() const;
+
+    void resetStats();
+};
+
+/**
+ * PagedSSTree
+ * Out-of-core layout of an SSTree: the internal nodes and the leaf spheres
+ * stay in memory, while the leaf entries are written to fixed-size pages of
+ * a file and read back through a BufferPool. Sibling leaves are written next
+ * to each other, so reading ahead the promising siblings of a leaf is a
+ * sequential scan of the file.
+ * The tree is read-only once built: it is either a snapshot of an in-memory
+ * SSTree or bulk-loaded from an EmbeddingReader, and adding entries means
+ * building it again.
+ */
+class PagedSSTree {
+private:
+    struct PagedNode {
+        Point center;
+        float radius;
+        bool isLeaf;
+        uint32_t page;
+        std::vector<uint32_t> children;
+        uint32_t parent;
+    };
+
+    std::vector<PagedNode> nodes; // nodes[0] is the root
+    size_t pageBytes = 0;
+    size_t numPages = 0;
+    size_t count = 0;
+    size_t readAhead;
+    std::unique_ptr<BufferPool> pool;
+
+    uint32_t layout(const SSNode *node, uint32_t parent, std::ofstream &out);
+
+    void writeLeaves(std::vector<std::unique_ptr<Data>> &batch,
+                     size_t entriesPerPage,
+                     std::ofstream &out, std::vector<uint32_t> &leaves);
+
+    void buildUpperLevels(std::vector<uint32_t> level, size_t fanout);
+
+    void readAheadSiblings(const Point &query, const PagedNode &leaf,
+                           float bound);
+
+public:
+    PagedSSTree(const SSTree &tree, const std::string &path, size_t poolPages,
+                size_t readAhead = 4);
+
+    PagedSSTree(EmbeddingReader &reader, const std::string &path,
+                size_t poolPages, size_t maxPointsPerNode = 20,
+                size_t batchSize = 4096, size_t readAhead = 4);
+
+    std::vector<Data> knn(const Point &query, size_t k);
+
+    // Getters
+    size_t size() const { return count; }
+
+    size_t getNumPages() const { return numPages; }
+
+    size_t getPageBytes() const { return pageBytes; }
+
+    BufferPoolStats getStats() const { return pool->getStats(); }
+
+    void resetStats() { pool->resetStats(); }
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+/**
+ * resolveThreads
+ * Returns numThreads, or the number of hardware threads when it is 0.
+ */
+inline size_t resolveThreads(size_t numThreads) {
+  if (numThreads == 0) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  return numThreads;
+}
+
+/**
+ * parallelFor
+ * Splits [begin, end) into one contiguous chunk per thread and runs
+ * body(threadIndex, chunkBegin, chunkEnd) on each. The calling thread runs
+ * the first chunk, so numThreads == 1 never spawns a thread.
+ * @param begin: First index.
+ * @param end: One past the last index.
+ * @param numThreads: Number of threads (0 uses all cores).
+ * @param body: Callable taking (size_t thread, size_t from, size_t to).
+ */
+template<typename Body>
+void parallelFor(size_t begin, size_t end, size_t numThreads, Body body) {
+  numThreads = std::min(resolveThreads(numThreads),
+                        std::max<size_t>(end - begin, 1));
+  size_t chunk = (end - begin + numThreads - 1) / numThreads;
+
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < numThreads; ++t) {
+    size_t from = std::min(end, begin + t * chunk);
+    size_t to = std::min(end, from + chunk);
+    threads.emplace_back(body, t, from, to);
+  }
+  body(0, begin, std::min(end, begin + chunk));
+  for (auto &thread: threads) {
+    thread.join();
+  }
+}
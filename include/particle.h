@@ -17,6 +17,8 @@ public:
 
     Point2D getVelocity() const;
 
+    static NType getTimeStep() { return timeStep; }
+
     void updatePosition(const Rect &boundary);
 
     friend std::ostream &
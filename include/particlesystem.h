@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "particle.h"
+
+/**
+ * ParticleSystem
+ * Particle store in struct-of-arrays layout: positions and velocities live
+ * in contiguous arrays and a particle is identified by its 32-bit index, so
+ * millions of particles cost four flat arrays instead of one heap object
+ * (and refcount) each.
+ */
+class ParticleSystem {
+public:
+    using Index = uint32_t;
+
+private:
+    std::vector<double> posX, posY;
+    std::vector<double> velX, velY;
+
+public:
+    ParticleSystem() = default;
+
+    void reserve(size_t n);
+
+    Index add(const Point2D &position, const Point2D &velocity);
+
+    Index add(const Particle &particle);
+
+    size_t size() const { return posX.size(); }
+
+    // Getters
+    Point2D getPosition(Index i) const { return {posX[i], posY[i]}; }
+
+    Point2D getVelocity(Index i) const { return {velX[i], velY[i]}; }
+
+    double getX(Index i) const { return posX[i]; }
+
+    double getY(Index i) const { return posY[i]; }
+
+    // Raw arrays, for batch kernels
+    const std::vector<double> &positionsX() const { return posX; }
+
+    const std::vector<double> &positionsY() const { return posY; }
+
+    const std::vector<double> &velocitiesX() const { return velX; }
+
+    const std::vector<double> &velocitiesY() const { return velY; }
+
+    // Integration
+    void updatePosition(Index i, const Rect &boundary);
+
+    void updatePositions(const Rect &boundary, size_t numThreads = 0);
+
+    void integrate(const Rect &boundary, size_t from, size_t to);
+};
@@ -132,6 +132,10 @@ public:
 
     explicit Point(const Eigen::VectorXf &coordinates);
 
+    // Copia DIM floats contiguos (p. ej. desde un archivo mapeado en memoria)
+    explicit Point(const float *coordinates)
+            : coordinates_(Eigen::Map<const Eigen::VectorXf>(coordinates, DIM)) {}
+
     // Operadores
     Point operator+(const Point &other) const;
 
@@ -156,16 +160,28 @@ public:
 
     float normSquared() const { return coordinates_.squaredNorm(); }
 
-    float distance(const Point &other) const { return (*this - other).norm(); }
+    float distance(const Point &other) const {
+      return (coordinates_ - other.coordinates_).norm();
+    }
 
     static float distance(const Point &a, const Point &b) {
       return a.distance(b);
     }
 
     float distanceSquared(const Point &other) const {
-      return (*this - other).normSquared();
+      return (coordinates_ - other.coordinates_).squaredNorm();
     }
 
+    // Distancia al cuadrado con abandono temprano: deja de acumular en cuanto
+    // la suma parcial supera bound (el valor devuelto solo garantiza ser > bound)
+    float distanceSquaredBounded(const Point &other, float bound) const;
+
+    // Igual que la anterior, contra DIM floats contiguos
+    float distanceSquaredBounded(const float *other, float bound) const;
+
+    // Coordenadas crudas (DIM floats contiguos)
+    const float *data() const { return coordinates_.data(); }
+
     // Operadores de acceso
     float operator[](std::size_t index) const { return coordinates_(index); }
 
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "particle.h"
+#include "particlesystem.h"
 
 #include <vector>
 #include <iostream>
@@ -8,55 +8,162 @@
 #include <random>
 #include <memory>
 #include <array>
+#include <mutex>
+#include <bit>
+#include <cstdint>
+
+class QuadNode;
+
+/**
+ * LeafCell
+ * Leaf holding a particle together with the leaf bounds as plain doubles,
+ * so checking whether the particle left its leaf reads one flat record
+ * instead of the node. The check is strict: a particle on the tolerance
+ * band of an edge is reported as outside and confirmed with Rect::contains.
+ */
+struct LeafCell {
+    QuadNode *leaf = nullptr;
+    double xmin = 0, ymin = 0, xmax = 0, ymax = 0;
+
+    bool contains(double x, double y) const {
+        return x >= xmin && x <= xmax && y >= ymin && y <= ymax;
+    }
+};
+
+class QuadNodePool;
 
 class QuadNode {
+public:
+    using Index = ParticleSystem::Index;
+
+    static constexpr uint32_t NONE = UINT32_MAX;
+
 private:
-    std::vector<std::shared_ptr<Particle>> particles; // Bucket size constraint
-    std::array<std::unique_ptr<QuadNode>, 4> children; // NW, NE, SW, SE
+    std::vector<Index> particles; // Bucket size constraint
     Rect boundary;
-    QuadNode *parent;
-    bool _isLeaf;
+    QuadNodePool *pool = nullptr;
+    std::vector<LeafCell> *owners = nullptr; // Leaf of each particle, shared by the tree
+    uint32_t self = NONE;
+    uint32_t parent = NONE;
+    uint32_t firstChild = NONE; // NW, NE, SW, SE are firstChild .. firstChild + 3
+    bool _isLeaf = true;
+
+    void addToBucket(Index particle);
+
+    bool propagate(Index particle, const ParticleSystem &system);
 
-    void addToBucket(const std::shared_ptr<Particle> &particle);
+    void subdivide(const ParticleSystem &system);
 
-    bool propagate(const std::shared_ptr<Particle> &particle);
+    void relocateParticle(Index particle,
+                          const ParticleSystem &system,
+                          const QuadNode *top = nullptr,
+                          std::vector<Index> *migrants = nullptr); // cuando se mueve la particula
 
-    void subdivide();
+    void updateWithin(const ParticleSystem &system, const QuadNode *top,
+                      std::vector<Index> *migrants);
 
-    void relocateParticle(
-            const std::shared_ptr<Particle> &particle); // cuando se mueve la particula
+    void detachLeaving(const ParticleSystem &system,
+                       std::vector<std::pair<QuadNode *, Index>> &leaving);
 
-    void removeEmptyNode(QuadNode *emptyChild);
+    bool mergeChildren(size_t threshold);
+
+    size_t depth() const;
+
+    QuadNode *parentNode() const;
 
 public:
-    QuadNode(NType xmin, NType ymin, NType xmax, NType ymax,
-             QuadNode *parent = nullptr)
-            : boundary(Point2D(xmin, ymin), Point2D(xmax, ymax)),
-              parent(parent), _isLeaf(true) {}
+    QuadNode() = default;
 
-    explicit QuadNode(const Rect &boundary, QuadNode *parent = nullptr)
-            : boundary(boundary), parent(parent), _isLeaf(true) {}
+    // Turns a pooled slot into a fresh leaf
+    void init(const Rect &_boundary, uint32_t _self, uint32_t _parent,
+              QuadNodePool *_pool, std::vector<LeafCell> *_owners);
 
-    bool insert(const std::shared_ptr<Particle> &particle);
+    bool insert(Index particle, const ParticleSystem &system);
     
-    void updateNode();
+    void updateNode(const ParticleSystem &system);
+
+    // Updates this subtree only; particles that leave it go to migrants
+    void updateNode(const ParticleSystem &system, std::vector<Index> &migrants);
+
+    // Moves one particle of this leaf's bucket to the leaf that now contains it
+    void relocate(Index particle, const ParticleSystem &system);
+
+    // Merges underfull subtrees bottom-up, descending at most maxDepth levels
+    void collapse(size_t threshold, size_t maxDepth = SIZE_MAX);
+
+    // Merges the parents of nodes that lost particles, and upwards from there
+    static void collapseParents(const std::vector<QuadNode *> &nodes,
+                                size_t threshold);
 
     // Getters
-    const std::vector<std::shared_ptr<Particle>> &
-    getParticles() const { return particles; }
+    const std::vector<Index> &getParticles() const { return particles; }
 
-    const std::unique_ptr<QuadNode> &
-    getChild(size_t index) const { return children[index]; }
+    QuadNode *getChild(size_t index) const;
 
-    const std::array<std::unique_ptr<QuadNode>, 4> &
-    getChildren() const { return children; }
+    std::array<QuadNode *, 4> getChildren() const;
 
     const Rect &getBoundary() const { return boundary; }
 
-    const QuadNode *getParent() const { return parent; }
+    const QuadNode *getParent() const { return parentNode(); }
+
+    uint32_t getIndex() const { return self; }
 
     // Setters
-    void setParent(QuadNode *_parent) { this->parent = _parent; }
+    void setOwnerTable(std::vector<LeafCell> *table) { owners = table; }
 
     bool isLeaf() const { return _isLeaf; }
 };
+
+/**
+ * QuadNodePool
+ * Node storage of one QuadTree. Nodes are allocated in groups of four
+ * siblings and addressed by 32-bit indices, so subdividing is a single
+ * bump allocation and the links between nodes do not depend on where the
+ * storage lives. The storage grows in blocks that double in size: an
+ * allocated node never moves, and growing never copies the tree. Groups
+ * freed by a collapse are reused first.
+ * Allocation is locked, since subtrees are subdivided in parallel.
+ */
+class QuadNodePool {
+private:
+    static constexpr unsigned FIRST_BLOCK_BITS = 6; // 64 nodes
+    static constexpr unsigned MAX_BLOCKS = 32 - FIRST_BLOCK_BITS;
+    // Nodes the blocks can address; keeps every index below NONE
+    static constexpr uint64_t MAX_NODES =
+            (uint64_t(1) << 32) - (uint64_t(1) << FIRST_BLOCK_BITS);
+
+    std::array<std::unique_ptr<QuadNode[]>, MAX_BLOCKS> blocks;
+    uint32_t used = 0; // Nodes handed out by bump allocation
+    std::vector<uint32_t> freeGroups;
+    std::mutex lock;
+
+public:
+    // Returns the index of the first of four consecutive nodes
+    uint32_t allocateGroup();
+
+    void freeGroup(uint32_t first);
+
+    QuadNode &at(uint32_t index) const {
+        uint64_t slot = uint64_t(index) + (uint64_t(1) << FIRST_BLOCK_BITS);
+        unsigned block = std::bit_width(slot) - 1 - FIRST_BLOCK_BITS;
+        return blocks[block][slot - (uint64_t(1) << (block + FIRST_BLOCK_BITS))];
+    }
+
+    // Getters
+    size_t getAllocatedNodes() const { return used; }
+
+    size_t getFreeGroups() const { return freeGroups.size(); }
+};
+
+inline QuadNode *QuadNode::parentNode() const {
+    return parent == NONE ? nullptr : &pool->at(parent);
+}
+
+inline QuadNode *QuadNode::getChild(size_t index) const {
+    return _isLeaf ? nullptr
+                   : &pool->at(firstChild + static_cast<uint32_t>(index));
+}
+
+inline std::array<QuadNode *, 4> QuadNode::getChildren() const {
+    return {getChild(0), getChild(1), getChild(2), getChild(3)};
+}
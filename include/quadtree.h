@@ -3,44 +3,205 @@
 #include <vector>
 #include <memory>
 #include <array>
+#include <algorithm>
 
 #include "quadnode.h"
+#include "knncontext.h"
+
+// Distances are squared
+using QuadKnnContext = KnnContext<double, ParticleSystem::Index, QuadNode>;
+using ParticlePair = std::pair<ParticleSystem::Index, ParticleSystem::Index>;
 
 class QuadTree {
 private:
-    std::unique_ptr<QuadNode> root;
+    // Node storage; on the heap so nodes keep their address when the tree moves
+    std::unique_ptr<QuadNodePool> pool;
+    QuadNode *root = nullptr;
+    const ParticleSystem *system = nullptr; // Set by insert
+    size_t indexed = 0; // Particles [0, indexed) of system are in the tree
+    // Per-thread particles that left their subtree, kept across frames
+    std::vector<std::vector<ParticleSystem::Index>> migrationQueues;
+    // Leaf holding each particle; on the heap so it survives moving the tree
+    std::unique_ptr<std::vector<LeafCell>> owners;
+
+    void makeRoot(const Rect &boundary);
+
+    template<typename Visit>
+    static void visitSubtree(const QuadNode *node, Visit &visit);
 
 public:
     static size_t bucketSize;
 
+    // Children are merged back when they hold at most this many particles
+    static size_t collapseThreshold() { return bucketSize / 2; }
+
     // Constructors
     QuadTree() = default;
 
     QuadTree(NType xmin, NType ymin, NType xmax, NType ymax,
-             size_t _bucketSize)
-            : root(std::make_unique<QuadNode>(
-            Rect(Point2D(xmin, ymin), Point2D(xmax, ymax)))) {
+             size_t _bucketSize) {
         QuadTree::bucketSize = _bucketSize;
+        makeRoot(Rect(Point2D(xmin, ymin), Point2D(xmax, ymax)));
     }
 
-    QuadTree(const Rect &boundary, size_t _bucketSize)
-            : root(std::make_unique<QuadNode>(boundary)) {
+    QuadTree(const Rect &boundary, size_t _bucketSize) {
         QuadTree::bucketSize = _bucketSize;
+        makeRoot(boundary);
     }
 
-    QuadTree(NType xmin, NType ymin, NType xmax, NType ymax)
-            : root(std::make_unique<QuadNode>(
-            Rect(Point2D(xmin, ymin), Point2D(xmax, ymax)))) {}
+    QuadTree(NType xmin, NType ymin, NType xmax, NType ymax) {
+        makeRoot(Rect(Point2D(xmin, ymin), Point2D(xmax, ymax)));
+    }
 
-    QuadTree(const Rect &boundary)
-            : root(std::make_unique<QuadNode>(boundary)) {}
+    QuadTree(const Rect &boundary) { makeRoot(boundary); }
 
-    void insert(const std::vector<std::shared_ptr<Particle>> &particles);
+    // Indexes the particles added to the system since the last insert; the
+    // system must outlive the tree and stay the same across calls
+    void insert(const ParticleSystem &particles);
 
-    std::vector<std::shared_ptr<Particle>>
+    std::vector<ParticleSystem::Index>
     knn(const Point2D &queryPoint, size_t k);
 
-    const std::unique_ptr<QuadNode> &getRoot() const { return root; }
+    void knn(const Point2D &queryPoint, size_t k, QuadKnnContext &context,
+             std::vector<ParticleSystem::Index> &result) const;
+
+    // Range queries; visit is called with each ParticleSystem::Index found
+    template<typename Visit>
+    void queryRect(const Rect &range, Visit visit) const;
+
+    void queryRect(const Rect &range,
+                   std::vector<ParticleSystem::Index> &result) const;
 
-    void updateTree();
-};
\ No newline at end of file
+    template<typename Visit>
+    void queryRadius(const Point2D &center, double radius, Visit visit) const;
+
+    void queryRadius(const Point2D &center, double radius,
+                     std::vector<ParticleSystem::Index> &result) const;
+
+    // Every pair of particles at most radius apart, each pair once as (i < j)
+    void collisionPairs(double radius, std::vector<ParticlePair> &pairs,
+                        size_t numThreads = 0) const;
+
+    QuadNode *getRoot() const { return root; }
+
+    const QuadNodePool &getPool() const { return *pool; }
+
+    const ParticleSystem *getSystem() const { return system; }
+
+    const QuadNode *getOwner(ParticleSystem::Index i) const {
+        return (*owners)[i].leaf;
+    }
+
+    // Moves particles to their new leaves after the system was integrated
+    void updateTree(size_t numThreads = 0);
+
+    // Same result as updateTree, but only relocates the particles that left
+    // their leaf
+    void updateMoved(size_t numThreads = 0);
+};
+
+template<typename Visit>
+void QuadTree::visitSubtree(const QuadNode *node, Visit &visit) {
+    if (node->isLeaf()) {
+        for (ParticleSystem::Index particle: node->getParticles()) {
+            visit(particle);
+        }
+        return;
+    }
+    for (const QuadNode *child: node->getChildren()) {
+        visitSubtree(child, visit);
+    }
+}
+
+/**
+ * queryRect
+ * Visits every particle inside range. A node inside range is reported
+ * whole without testing its particles, a node that does not touch range
+ * is skipped, and only leaves straddling its border test each particle.
+ */
+template<typename Visit>
+void QuadTree::queryRect(const Rect &range, Visit visit) const {
+    if (!root) {
+        return;
+    }
+    std::vector<const QuadNode *> pending{root};
+    while (!pending.empty()) {
+        const QuadNode *node = pending.back();
+        pending.pop_back();
+        if (!node->getBoundary().touches(range)) {
+            continue;
+        }
+        if (node->getBoundary().isWithin(range)) {
+            visitSubtree(node, visit);
+        } else if (node->isLeaf()) {
+            for (ParticleSystem::Index particle: node->getParticles()) {
+                if (range.contains(system->getPosition(particle))) {
+                    visit(particle);
+                }
+            }
+        } else {
+            for (const QuadNode *child: node->getChildren()) {
+                pending.push_back(child);
+            }
+        }
+    }
+}
+
+/**
+ * queryRadius
+ * Visits every particle within radius of center. A node whose farthest
+ * corner is within the radius is reported whole; one whose closest point
+ * is beyond it is skipped. Distances are compared squared, in plain
+ * doubles: particles are tested exactly against the radius, and since a
+ * leaf accepts particles up to NType's tolerance outside its Rect, node
+ * bounds are widened by that tolerance before either shortcut.
+ */
+template<typename Visit>
+void QuadTree::queryRadius(const Point2D &center, double radius,
+                           Visit visit) const {
+    if (!root || radius < 0) {
+        return;
+    }
+    double cx = static_cast<double>(center.getX().getValue());
+    double cy = static_cast<double>(center.getY().getValue());
+    double radiusSquared = radius * radius;
+    constexpr double tolerance = 1e-6; // NType's comparison epsilon
+
+    std::vector<const QuadNode *> pending{root};
+    while (!pending.empty()) {
+        const QuadNode *node = pending.back();
+        pending.pop_back();
+        const Rect &bounds = node->getBoundary();
+        double xmin = static_cast<double>(bounds.getPmin().getX().getValue())
+                      - tolerance;
+        double ymin = static_cast<double>(bounds.getPmin().getY().getValue())
+                      - tolerance;
+        double xmax = static_cast<double>(bounds.getPmax().getX().getValue())
+                      + tolerance;
+        double ymax = static_cast<double>(bounds.getPmax().getY().getValue())
+                      + tolerance;
+
+        double nearX = std::max({xmin - cx, 0.0, cx - xmax});
+        double nearY = std::max({ymin - cy, 0.0, cy - ymax});
+        if (nearX * nearX + nearY * nearY > radiusSquared) {
+            continue;
+        }
+        double farX = std::max(cx - xmin, xmax - cx);
+        double farY = std::max(cy - ymin, ymax - cy);
+        if (farX * farX + farY * farY <= radiusSquared) {
+            visitSubtree(node, visit);
+        } else if (node->isLeaf()) {
+            for (ParticleSystem::Index particle: node->getParticles()) {
+                double dx = system->getX(particle) - cx;
+                double dy = system->getY(particle) - cy;
+                if (dx * dx + dy * dy <= radiusSquared) {
+                    visit(particle);
+                }
+            }
+        } else {
+            for (const QuadNode *child: node->getChildren()) {
+                pending.push_back(child);
+            }
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include "sstree.h"
+
+// Counters of a KnnQueryCache
+struct QueryCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t stale = 0;       // Misses on entries computed before a tree update
+    size_t entries = 0;
+    size_t memoryBytes = 0; // Approximate footprint of the cached entries
+
+    double hitRate() const {
+      size_t lookups = hits + misses;
+      return lookups ? static_cast<double>(hits) / static_cast<double>(lookups)
+                     : 0.0;
+    }
+};
+
+/**
+ * KnnQueryCache
+ * LRU cache of kNN results in front of an SSTree. Entries are bucketed by a
+ * hash of the query quantized to a grid of step quantum plus k; a bucket
+ * chains every cached query that falls into it, and a hit requires a
+ * bit-identical query and the same k, so a cached result is always the
+ * exact answer and near-identical queries do not evict each other. Each entry records the tree version it was
+ * computed at; after an insert or remove the entry is stale and the next
+ * lookup recomputes it.
+ * The tree must not be modified while a knn call is running.
+ */
+class KnnQueryCache {
+private:
+    struct Entry {
+        uint64_t key;
+        Point query;
+        size_t k;
+        uint64_t version;
+        std::vector<Data *> result;
+    };
+
+    SSTree &tree;
+    size_t capacity;
+    float quantum;
+
+    mutable std::mutex lock;
+    std::list<Entry> lru; // Most recently used first
+    // Quantized hash to the entries chained in that bucket
+    std::unordered_map<uint64_t, std::vector<std::list<Entry>::iterator>>
+            index;
+    QueryCacheStats stats;
+
+    uint64_t hashQuery(const Point &query, size_t k) const;
+
+    static size_t entryBytes(const Entry &entry);
+
+    void evict(std::list<Entry>::iterator entry);
+
+public:
+    explicit KnnQueryCache(SSTree &tree, size_t capacity = 1024,
+                           float quantum = 1e-4f);
+
+    std::vector<Data *> knn(const Point &query, size_t k);
+
+    void clear();
+
+    // Getters
+    QueryCacheStats getStats() const;
+};
@@ -22,6 +22,9 @@ public:
 
     bool intersects(const Rect &rect) const;
 
+    // Like intersects, but rects sharing only an edge or corner also count
+    bool touches(const Rect &rect) const;
+
     bool isWithin(const Rect &rect) const;
 
     bool isValid() const;
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <condition_variable>
+#include "sstree.h"
+
+// How entries are assigned to shards
+enum ShardPolicy {
+    HASH_SHARDING,   // Hash of the image path
+    CLUSTER_SHARDING // Nearest routing centroid (e.g. IVF centroids)
+};
+
+/**
+ * ShardedSSTree
+ * Partitions Data across N independent SSTrees, each owned by one worker
+ * thread. Inserts are queued to the owning shard and return immediately;
+ * kNN fans out to every shard and merges the per-shard top-k with a bounded
+ * heap. A shard's tree is only touched by its worker, so shards need no
+ * locking and queries see every insert queued before them.
+ */
+class ShardedSSTree {
+private:
+    struct Shard {
+        SSTree tree;
+        std::thread worker;
+        std::mutex lock;
+        std::condition_variable ready;
+        std::deque<std::function<void()>> tasks;
+        bool stopping = false;
+        std::atomic<size_t> size{0};
+
+        explicit Shard(const SSTree &tree) : tree(tree) {}
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    ShardPolicy policy;
+    std::vector<Point> routingCentroids;
+
+    static void run(Shard &shard);
+
+    void enqueue(size_t shard, std::function<void()> task);
+
+public:
+    explicit ShardedSSTree(size_t numShards, size_t maxPointsPerNode = 20,
+                           ShardPolicy policy = HASH_SHARDING);
+
+    ~ShardedSSTree();
+
+    ShardedSSTree(const ShardedSSTree &) = delete;
+
+    ShardedSSTree &operator=(const ShardedSSTree &) = delete;
+
+    // One centroid per shard, required by CLUSTER_SHARDING
+    void setRoutingCentroids(const std::vector<Point> &centroids);
+
+    size_t shardFor(const Data *_data) const;
+
+    void insert(Data *_data);
+
+    void insert(const std::vector<Data *> &data);
+
+    // Blocks until every queued insert has been applied
+    void flush();
+
+    std::vector<Data *> knn(Point &query, size_t k);
+
+    // Getters
+    size_t numShards() const { return shards.size(); }
+
+    size_t size() const;
+
+    // Only safe to inspect after flush()
+    const SSTree &getShard(size_t shard) const { return shards[shard]->tree; }
+};
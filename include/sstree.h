@@ -4,16 +4,53 @@
 #include <limits>
 #include <algorithm>
 #include <numeric>
+#include <queue>
+#include <string>
+#include <atomic>
 #include "point.h"
 #include "data.h"
+#include "knncontext.h"
+
+class SSNode;
+
+// How the bounding sphere of a node is centered
+enum SphereMode {
+    CENTROID_SPHERE,     // Centered on the centroid of the entries
+    MIN_ENCLOSING_SPHERE // Approximate minimum enclosing ball (Badoiu-Clarkson)
+};
+
+using SSKnnContext = KnnContext<float, Data *, SSNode>;
+
+/**
+ * KnnFilter
+ * Conjunction of predicates over the metadata columns of Data: the category
+ * must be one of categories (any if empty) and the timestamp must lie in
+ * [minTimestamp, maxTimestamp].
+ */
+struct KnnFilter {
+    std::vector<uint32_t> categories;
+    int64_t minTimestamp = std::numeric_limits<int64_t>::min();
+    int64_t maxTimestamp = std::numeric_limits<int64_t>::max();
+
+    bool matches(const Data &entry) const;
+
+    // False only if no entry of the node's subtree can match
+    bool mayMatch(const SSNode &node) const;
+};
 
 class SSNode {
 private:
     size_t maxPointsPerNode;
-    Point centroid;
+    SphereMode sphereMode;
+    Point centroid; // Mean of the entries, used to route insertions
+    Point center;   // Center of the bounding sphere
     float radius;
     SSNode *parent;
     std::vector<Data *> _data;
+    // Metadata summary of the subtree
+    uint64_t categoryMask = 0;
+    int64_t minTimestamp = std::numeric_limits<int64_t>::max();
+    int64_t maxTimestamp = std::numeric_limits<int64_t>::min();
 
     // For searching
     SSNode *findClosestChild(const Point &target);
@@ -28,15 +65,21 @@ private:
 
     size_t minVarianceSplit(const std::vector<float> &values);
 
+    float coveringRadius(const Point &sphereCenter) const;
+
+    Point minimumEnclosingCenter() const;
+
 public:
     bool isLeaf;
 
     std::vector<SSNode *> children;
 
     SSNode(const Point &centroid, float radius = 0.0f, bool isLeaf = true,
-           SSNode *parent = nullptr, size_t maxPointsPerNode = 20)
-            : centroid(centroid), radius(radius), isLeaf(isLeaf),
-              parent(parent), maxPointsPerNode(maxPointsPerNode) {}
+           SSNode *parent = nullptr, size_t maxPointsPerNode = 20,
+           SphereMode sphereMode = CENTROID_SPHERE)
+            : centroid(centroid), center(centroid), radius(radius),
+              isLeaf(isLeaf), parent(parent),
+              maxPointsPerNode(maxPointsPerNode), sphereMode(sphereMode) {}
 
     // Checks if a point is inside the bounding sphere
     bool intersectsPoint(const Point &point) const;
@@ -46,6 +89,8 @@ public:
     // Getters
     const Point &getCentroid() const { return centroid; }
 
+    const Point &getCenter() const { return center; }
+
     float getRadius() const { return radius; }
 
     const std::vector<SSNode *> &getChildren() const { return children; }
@@ -56,37 +101,104 @@ public:
 
     SSNode *getParent() const { return parent; }
 
+    uint64_t getCategoryMask() const { return categoryMask; }
+
+    int64_t getMinTimestamp() const { return minTimestamp; }
+
+    int64_t getMaxTimestamp() const { return maxTimestamp; }
+
+    // Setters
+    void setParent(SSNode *_parent) { this->parent = _parent; }
+
     // Insertion
     SSNode *searchParentLeaf(SSNode *node, const Point &target);
 
-    std::pair<SSNode *, SSNode *> insert(SSNode *node, Data *_data);
+    std::pair<SSNode *, SSNode *> insert(SSNode *node, Data *_data,
+                                         std::vector<Data *> *evicted = nullptr,
+                                         float reinsertFraction = 0.0f,
+                                         bool *added = nullptr);
+
+    // Removal
+    SSNode *findLeaf(const Data *entry);
+
+    bool remove(Data *entry);
 
     // Search
     SSNode *search(SSNode *node, Data *_data);
 
-    void knn(SSNode *&node, Point &query, size_t k,
-             std::priority_queue<std::pair<float, Data *>> &max_heap);
+    void knn(const Point &query, SSKnnContext &context,
+             std::atomic<float> *sharedBound = nullptr,
+             const KnnFilter *filter = nullptr);
+
+    void updateBoundingEnvelope(bool refit = false);
+
+    void updateSummary();
+};
 
-    void updateBoundingEnvelope();
+// Shape statistics of an SSTree, used to compare construction strategies
+struct SSTreeQuality {
+    size_t height = 0;
+    size_t nodeCount = 0;
+    size_t leafCount = 0;
+    double meanRadius = 0.0;
+    // log of the summed sphere volumes (the volumes overflow in DIM dims)
+    double logTotalVolume = -std::numeric_limits<double>::infinity();
+    // Summed overlap depth (ri + rj - dij) over overlapping sibling pairs
+    double siblingOverlap = 0.0;
+    size_t overlappingPairs = 0;
 };
 
 class SSTree {
 private:
-    SSNode *root;
-    size_t maxPointsPerNode;
+    SSNode *root = nullptr;
+    size_t maxPointsPerNode = 20;
+    // Fraction of a leaf reinserted on its first overflow (0 disables it)
+    float reinsertFraction = 0.0f;
+    SphereMode sphereMode = CENTROID_SPHERE;
+    // Bumped by every insert and remove, so cached results can be validated
+    uint64_t version = 0;
 
 public:
-    SSTree(size_t maxPointsPerNode)
-            : maxPointsPerNode(maxPointsPerNode), root(nullptr) {}
+    SSTree(size_t maxPointsPerNode, float reinsertFraction = 0.0f,
+           SphereMode sphereMode = CENTROID_SPHERE)
+            : maxPointsPerNode(maxPointsPerNode),
+              reinsertFraction(reinsertFraction), sphereMode(sphereMode) {}
 
     SSTree() = default;
 
-    void insert(Data *_data);
+    // False if the entry was already in the tree
+    bool insert(Data *_data);
+
+    bool remove(Data *_data);
 
     SSNode *search(Data *_data);
 
     SSNode *getRoot() const { return root; }
 
+    uint64_t getVersion() const { return version; }
+
+    SSTreeQuality quality() const;
+
     std::vector<Data *> knn(Point &query, size_t k);
+
+    void knn(const Point &query, size_t k, SSKnnContext &context,
+             std::vector<Data *> &result) const;
+
+    // Same search, with the distance of each neighbor
+    void knn(const Point &query, size_t k, SSKnnContext &context,
+             std::vector<SSKnnContext::Entry> &result) const;
+
+    std::vector<Data *> knn(const Point &query, size_t k,
+                            const KnnFilter &filter) const;
+
+    std::vector<Data *> parallelKnn(const Point &query, size_t k,
+                                    size_t numThreads = 0) const;
+
+    // Similarity join
+    std::vector<std::pair<Data *, Data *>>
+    selfJoin(float tau, size_t numThreads = 0) const;
+
+    std::vector<std::pair<std::string, std::string>>
+    nearDuplicates(float tau, size_t numThreads = 0) const;
 };
 
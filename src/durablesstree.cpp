@@ -0,0 +1,484 @@
+#include "durablesstree.h"
+#include <cstring>
+#include <charconv>
+#include <stdexcept>
+#include <utility>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Record: payload length, payload checksum, then the payload (type, path
+// length, path bytes and, for inserts, DIM floats)
+enum WalRecordType : uint8_t {
+    WAL_INSERT = 1,
+    WAL_REMOVE = 2
+};
+
+struct WalRecord {
+    WalRecordType type;
+    std::string path;
+    Point embedding;
+};
+
+static uint32_t checksum(const char *bytes, size_t size) {
+  uint32_t hash = 2166136261u; // FNV-1a
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(bytes[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void encodeRecord(std::vector<char> &out, WalRecordType type,
+                         const std::string &path, const Point *embedding) {
+  if (path.size() > UINT16_MAX) {
+    throw std::invalid_argument("Image path too long for the log: " + path);
+  }
+  auto pathLength = static_cast<uint16_t>(path.size());
+  uint32_t length = 1 + sizeof(pathLength) + pathLength +
+                    (embedding ? DIM * sizeof(float) : 0);
+
+  size_t start = out.size();
+  out.resize(start + 2 * sizeof(uint32_t) + length);
+  char *header = out.data() + start;
+  char *payload = header + 2 * sizeof(uint32_t);
+
+  payload[0] = static_cast<char>(type);
+  std::memcpy(payload + 1, &pathLength, sizeof(pathLength));
+  std::memcpy(payload + 1 + sizeof(pathLength), path.data(), pathLength);
+  if (embedding) {
+    std::memcpy(payload + 1 + sizeof(pathLength) + pathLength,
+                embedding->data(), DIM * sizeof(float));
+  }
+
+  uint32_t sum = checksum(payload, length);
+  std::memcpy(header, &length, sizeof(length));
+  std::memcpy(header + sizeof(length), &sum, sizeof(sum));
+}
+
+/**
+ * readRecord
+ * Reads the next record of a log or snapshot.
+ * @return bool: False at the end of the file or at a torn or corrupt record.
+ */
+static bool readRecord(std::FILE *file, std::vector<char> &buffer,
+                       WalRecord &record) {
+  uint32_t header[2];
+  if (std::fread(header, sizeof(uint32_t), 2, file) != 2) {
+    return false;
+  }
+  uint32_t length = header[0];
+  if (length < 1 + sizeof(uint16_t) ||
+      length > 1 + sizeof(uint16_t) + UINT16_MAX + DIM * sizeof(float)) {
+    return false;
+  }
+  buffer.resize(length);
+  if (std::fread(buffer.data(), 1, length, file) != length ||
+      checksum(buffer.data(), length) != header[1]) {
+    return false;
+  }
+
+  uint16_t pathLength;
+  std::memcpy(&pathLength, buffer.data() + 1, sizeof(pathLength));
+  size_t offset = 1 + sizeof(pathLength);
+  if (offset + pathLength > length) {
+    return false;
+  }
+  record.type = static_cast<WalRecordType>(buffer[0]);
+  record.path.assign(buffer.data() + offset, pathLength);
+  offset += pathLength;
+
+  if (record.type == WAL_INSERT) {
+    if (length - offset != DIM * sizeof(float)) {
+      return false;
+    }
+    record.embedding = Point(Eigen::Map<const Eigen::VectorXf>(
+            reinterpret_cast<const float *>(buffer.data() + offset), DIM));
+  } else if (record.type != WAL_REMOVE) {
+    return false;
+  }
+  return true;
+}
+
+// Flushes a file to stable storage
+static void syncFile(std::FILE *file) {
+  if (std::fflush(file) != 0) {
+    throw std::runtime_error("Cannot flush the write-ahead log");
+  }
+#ifdef __unix__
+  if (fsync(fileno(file)) != 0) {
+    throw std::runtime_error("Cannot sync the write-ahead log");
+  }
+#endif
+}
+
+// Makes the creations, renames and removals of entries in a directory
+// durable, so a later step never depends on a change that may be lost
+static void syncDirectory(const fs::path &directory) {
+#ifdef __unix__
+  int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot open directory " + directory.string());
+  }
+  int result = fsync(fd);
+  close(fd);
+  if (result != 0) {
+    throw std::runtime_error("Cannot sync directory " + directory.string());
+  }
+#endif
+}
+
+/**
+ * parseGeneration
+ * Reads the generation of a file named prefix followed by decimal digits.
+ * @return bool: False for any other name, including overflowing numbers.
+ */
+static bool parseGeneration(const std::string &name, const std::string &prefix,
+                            uint64_t &generation) {
+  if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix)) {
+    return false;
+  }
+  const char *first = name.data() + prefix.size();
+  const char *last = name.data() + name.size();
+  if (!std::all_of(first, last, [](char c) { return c >= '0' && c <= '9'; })) {
+    return false;
+  }
+  auto [end, error] = std::from_chars(first, last, generation);
+  return error == std::errc() && end == last;
+}
+
+static fs::path logPath(const fs::path &directory, uint64_t generation) {
+  return directory / ("wal." + std::to_string(generation));
+}
+
+static fs::path snapshotPath(const fs::path &directory, uint64_t generation) {
+  return directory / ("snapshot." + std::to_string(generation));
+}
+
+/**
+ * writeSnapshot
+ * Writes the snapshot of a generation under a temporary name, syncs and
+ * renames it, syncs the directory so the rename is durable, and only then
+ * deletes the files of the previous generation.
+ * @param directory: Directory of the tree.
+ * @param generation: Generation the snapshot starts.
+ * @param entries: Live entries when the generation started.
+ */
+static void
+writeSnapshot(const fs::path &directory, uint64_t generation,
+              const std::vector<std::shared_ptr<const Data>> &entries) {
+  std::vector<char> snapshot;
+  for (const auto &entry: entries) {
+    encodeRecord(snapshot, WAL_INSERT, entry->getPath(),
+                 &entry->getEmbedding());
+  }
+
+  fs::path temporary = snapshotPath(directory, generation).string() + ".tmp";
+  std::FILE *file = std::fopen(temporary.c_str(), "wb");
+  if (!file) {
+    throw std::runtime_error("Cannot create snapshot " + temporary.string());
+  }
+  bool written = std::fwrite(snapshot.data(), 1, snapshot.size(), file) ==
+                 snapshot.size();
+  try {
+    syncFile(file);
+  } catch (const std::exception &) {
+    written = false;
+  }
+  std::fclose(file);
+  if (!written) {
+    fs::remove(temporary);
+    throw std::runtime_error("Cannot write snapshot " + temporary.string());
+  }
+
+  fs::rename(temporary, snapshotPath(directory, generation));
+  syncDirectory(directory);
+  std::error_code error;
+  fs::remove(snapshotPath(directory, generation - 1), error);
+  fs::remove(logPath(directory, generation - 1), error);
+}
+
+/**
+ * DurableSSTree
+ * Opens (or creates) a persisted tree and recovers its state.
+ * @param directory: Directory holding the snapshot and log files.
+ * @param maxPointsPerNode: Node capacity of the in-memory tree.
+ * @param groupCommitSize: Records written and synced together.
+ */
+DurableSSTree::DurableSSTree(const std::string &directory,
+                             size_t maxPointsPerNode, size_t groupCommitSize)
+        : directory(directory),
+          groupCommitSize(std::max<size_t>(groupCommitSize, 1)),
+          tree(maxPointsPerNode) {
+  fs::create_directories(this->directory);
+  recover();
+  openLog();
+}
+
+DurableSSTree::~DurableSSTree() {
+  if (compaction.joinable()) {
+    compaction.join();
+  }
+  try {
+    commit();
+  } catch (const std::exception &) {
+    // Unreported; callers that need to know commit() before destroying
+  }
+  if (log) {
+    std::fclose(log);
+  }
+}
+
+/**
+ * recover
+ * Loads the newest snapshot, then replays every log of that generation or
+ * later in order. Files of older generations and unfinished snapshots are
+ * deleted, and a torn tail of the newest log is cut off so new records are
+ * appended after the last valid one. Files whose names do not match the
+ * snapshot and log patterns exactly are left alone.
+ */
+void DurableSSTree::recover() {
+  std::vector<uint64_t> snapshots = {0};
+  std::vector<uint64_t> logs;
+  for (const auto &file: fs::directory_iterator(directory)) {
+    std::string name = file.path().filename().string();
+    uint64_t g;
+    if (file.path().extension() == ".tmp" &&
+        parseGeneration(file.path().stem().string(), "snapshot.", g)) {
+      fs::remove(file.path());
+    } else if (parseGeneration(name, "snapshot.", g)) {
+      snapshots.push_back(g);
+    } else if (parseGeneration(name, "wal.", g)) {
+      logs.push_back(g);
+    }
+  }
+  std::sort(logs.begin(), logs.end());
+  uint64_t base = *std::max_element(snapshots.begin(), snapshots.end());
+  generation = base;
+
+  std::vector<char> buffer;
+  WalRecord record;
+  if (fs::exists(snapshotPath(directory, base))) {
+    std::FILE *file = std::fopen(snapshotPath(directory, base).c_str(), "rb");
+    if (!file) {
+      throw std::runtime_error("Cannot open snapshot " +
+                               snapshotPath(directory, base).string());
+    }
+    while (readRecord(file, buffer, record)) {
+      applyInsert(record.embedding, record.path);
+    }
+    std::fclose(file);
+  }
+
+  for (uint64_t g: logs) {
+    if (g < base) {
+      fs::remove(logPath(directory, g));
+      continue;
+    }
+    std::FILE *file = std::fopen(logPath(directory, g).c_str(), "rb");
+    if (!file) {
+      throw std::runtime_error("Cannot open log " +
+                               logPath(directory, g).string());
+    }
+    long valid = 0;
+    while (readRecord(file, buffer, record)) {
+      if (record.type == WAL_INSERT) {
+        applyInsert(record.embedding, record.path);
+      } else {
+        applyRemove(record.path);
+      }
+      valid = std::ftell(file);
+    }
+    std::fclose(file);
+    if (fs::file_size(logPath(directory, g)) != static_cast<uintmax_t>(valid)) {
+      fs::resize_file(logPath(directory, g), valid);
+    }
+    generation = g;
+  }
+  for (uint64_t g: snapshots) {
+    if (g < base) {
+      fs::remove(snapshotPath(directory, g));
+    }
+  }
+}
+
+// Opens the log of the current generation for appending and syncs its
+// directory entry, which may be new
+void DurableSSTree::openLog() {
+  fs::path path = logPath(directory, generation);
+  log = std::fopen(path.c_str(), "ab");
+  if (!log) {
+    throw std::runtime_error("Cannot open log " + path.string());
+  }
+  syncDirectory(directory);
+}
+
+// Writes and syncs the open group; the caller holds the lock
+void DurableSSTree::writePending() {
+  if (pending.empty()) {
+    return;
+  }
+  if (std::fwrite(pending.data(), 1, pending.size(), log) != pending.size()) {
+    throw std::runtime_error("Cannot append to the write-ahead log");
+  }
+  syncFile(log);
+  pending.clear();
+  pendingRecords = 0;
+}
+
+void DurableSSTree::applyInsert(const Point &embedding,
+                                const std::string &path) {
+  applyRemove(path);
+  auto entry = std::make_shared<Data>(embedding, path);
+  tree.insert(entry.get());
+  live[path] = std::move(entry);
+}
+
+/**
+ * applyRemove
+ * Takes an entry out of the tree and the live set. An entry the tree cannot
+ * find stays live, so the tree never points to a freed Data.
+ * @param path: Image path.
+ * @return bool: True if the path was live.
+ */
+bool DurableSSTree::applyRemove(const std::string &path) {
+  auto it = live.find(path);
+  if (it == live.end()) {
+    return false;
+  }
+  if (!tree.remove(it->second.get())) {
+    throw std::runtime_error("Entry " + path + " is live but not in the tree");
+  }
+  live.erase(it);
+  return true;
+}
+
+/**
+ * insert
+ * Logs and applies an insert. The record is written with its group. If the
+ * entry it replaces cannot be taken out of the tree, nothing is logged and
+ * std::runtime_error is thrown.
+ * @param embedding: Embedding of the image.
+ * @param path: Image path, the key of the entry.
+ */
+void DurableSSTree::insert(const Point &embedding, const std::string &path) {
+  std::lock_guard<std::mutex> guard(lock);
+  size_t mark = pending.size();
+  encodeRecord(pending, WAL_INSERT, path, &embedding);
+  try {
+    applyInsert(embedding, path);
+  } catch (...) {
+    pending.resize(mark); // Log only what was applied
+    throw;
+  }
+  if (++pendingRecords >= groupCommitSize) {
+    writePending();
+  }
+}
+
+/**
+ * remove
+ * Logs and applies the removal of a path. If the tree cannot find the
+ * entry, nothing is logged and std::runtime_error is thrown.
+ * @param path: Image path.
+ * @return bool: True if the path was in the tree.
+ */
+bool DurableSSTree::remove(const std::string &path) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (!applyRemove(path)) {
+    return false;
+  }
+  encodeRecord(pending, WAL_REMOVE, path, nullptr);
+  if (++pendingRecords >= groupCommitSize) {
+    writePending();
+  }
+  return true;
+}
+
+void DurableSSTree::commit() {
+  std::lock_guard<std::mutex> guard(lock);
+  writePending();
+}
+
+/**
+ * compact
+ * Commits the open group, takes a reference to every live entry and
+ * switches to the log of the next generation; the lock is only held for
+ * that. A background thread then encodes the entries and publishes them
+ * with writeSnapshot. A crash at any point leaves either the old snapshot
+ * and both logs, or the new snapshot, to recover from. A failure of the
+ * background thread is rethrown by the next waitForCompaction() or
+ * compact().
+ */
+void DurableSSTree::compact() {
+  waitForCompaction();
+
+  std::vector<std::shared_ptr<const Data>> entries;
+  uint64_t next;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    writePending();
+    entries.reserve(live.size());
+    for (const auto &[path, entry]: live) {
+      entries.push_back(entry);
+    }
+    next = generation + 1;
+    std::fclose(log);
+    log = nullptr;
+    generation = next;
+    openLog();
+  }
+
+  compaction = std::thread([this, next, entries = std::move(entries)]() {
+      try {
+        writeSnapshot(directory, next, entries);
+      } catch (...) {
+        compactionError = std::current_exception();
+      }
+  });
+}
+
+/**
+ * waitForCompaction
+ * Waits for the running compaction, if any, and rethrows its error. The
+ * previous generation is kept when a compaction fails, so the tree stays
+ * recoverable and compact() can simply be called again.
+ */
+void DurableSSTree::waitForCompaction() {
+  if (compaction.joinable()) {
+    compaction.join();
+  }
+  if (compactionError) {
+    std::rethrow_exception(std::exchange(compactionError, nullptr));
+  }
+}
+
+/**
+ * knn
+ * Finds the k nearest neighbors of a query point.
+ * @param query: Query point.
+ * @param k: Number of neighbors.
+ * @return std::vector<Data *>: Neighbors, closest first.
+ */
+std::vector<Data *> DurableSSTree::knn(const Point &query, size_t k) const {
+  static thread_local SSKnnContext context;
+
+  std::vector<Data *> result;
+  std::lock_guard<std::mutex> guard(lock);
+  tree.knn(query, k, context, result);
+  return result;
+}
+
+size_t DurableSSTree::size() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return live.size();
+}
+
+uint64_t DurableSSTree::getGeneration() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return generation;
+}
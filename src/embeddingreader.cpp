@@ -0,0 +1,261 @@
+#include "embeddingreader.h"
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static bool endsWith(const std::string &text, const std::string &suffix) {
+  return text.size() >= suffix.size() &&
+         text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/**
+ * EmbeddingReader
+ * Maps an embedding file and validates its header.
+ * @param embeddingsPath: .fvecs or .npy file.
+ * @param pathsFile: Text file with one path per vector, or "" to use indices.
+ */
+EmbeddingReader::EmbeddingReader(const std::string &embeddingsPath,
+                                 const std::string &pathsFile) {
+  if (endsWith(embeddingsPath, ".fvecs")) {
+    format = FVECS;
+  } else if (endsWith(embeddingsPath, ".npy")) {
+    format = NPY;
+  } else {
+    throw std::invalid_argument("Unknown embedding format: " + embeddingsPath);
+  }
+
+  int fd = open(embeddingsPath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot open " + embeddingsPath);
+  }
+  struct stat info{};
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw std::runtime_error("Cannot stat " + embeddingsPath);
+  }
+  mappingSize = static_cast<size_t>(info.st_size);
+  if (mappingSize > 0) {
+    void *address = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Cannot map " + embeddingsPath);
+    }
+    mapping = static_cast<const char *>(address);
+    madvise(address, mappingSize, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  try {
+    if (format == FVECS) {
+      parseFvecs();
+    } else {
+      parseNpy();
+    }
+    if (!pathsFile.empty()) {
+      paths.open(pathsFile);
+      if (!paths) {
+        throw std::runtime_error("Cannot open " + pathsFile);
+      }
+    }
+  } catch (...) {
+    if (mapping) {
+      munmap(const_cast<char *>(mapping), mappingSize);
+    }
+    throw;
+  }
+}
+
+EmbeddingReader::~EmbeddingReader() {
+  if (mapping) {
+    munmap(const_cast<char *>(mapping), mappingSize);
+  }
+}
+
+void EmbeddingReader::parseFvecs() {
+  stride = sizeof(int32_t) + DIM * sizeof(float);
+  if (mappingSize % stride != 0) {
+    throw std::runtime_error("fvecs size is not a multiple of a DIM vector");
+  }
+  if (mappingSize > 0) {
+    int32_t dimension;
+    std::memcpy(&dimension, mapping, sizeof(dimension));
+    if (dimension != static_cast<int32_t>(DIM)) {
+      throw std::runtime_error("fvecs dimension " + std::to_string(dimension) +
+                               " does not match DIM");
+    }
+  }
+  vectors = mapping + sizeof(int32_t);
+  count = mappingSize / stride;
+}
+
+/**
+ * parseNpy
+ * Reads the NumPy header (format versions 1 to 3) and checks that the array
+ * is a C-ordered little-endian float32 matrix with DIM columns.
+ */
+void EmbeddingReader::parseNpy() {
+  static const char MAGIC[] = "\x93NUMPY";
+  if (mappingSize < 10 || std::memcmp(mapping, MAGIC, 6) != 0) {
+    throw std::runtime_error("Not a .npy file");
+  }
+
+  auto major = static_cast<unsigned char>(mapping[6]);
+  size_t headerLength;
+  size_t headerStart;
+  if (major == 1) {
+    uint16_t length;
+    std::memcpy(&length, mapping + 8, sizeof(length));
+    headerLength = length;
+    headerStart = 10;
+  } else {
+    uint32_t length;
+    if (mappingSize < 12) {
+      throw std::runtime_error("Truncated .npy header");
+    }
+    std::memcpy(&length, mapping + 8, sizeof(length));
+    headerLength = length;
+    headerStart = 12;
+  }
+  if (headerStart + headerLength > mappingSize) {
+    throw std::runtime_error("Truncated .npy header");
+  }
+  std::string header(mapping + headerStart, headerLength);
+
+  auto value = [&header](const std::string &key) {
+      size_t at = header.find("'" + key + "'");
+      if (at == std::string::npos) {
+        throw std::runtime_error("Missing '" + key + "' in .npy header");
+      }
+      at = header.find(':', at) + 1;
+      while (at < header.size() && header[at] == ' ') {
+        at++;
+      }
+      return at;
+  };
+
+  size_t descr = value("descr");
+  if (header.compare(descr, 5, "'<f4'") != 0 &&
+      header.compare(descr, 5, "'=f4'") != 0) {
+    throw std::runtime_error("Only little-endian float32 .npy is supported");
+  }
+  if (header.compare(value("fortran_order"), 5, "False") != 0) {
+    throw std::runtime_error("Only C-ordered .npy is supported");
+  }
+
+  size_t shape = value("shape");
+  size_t shapeEnd = header.find(')', shape);
+  std::vector<size_t> dims;
+  for (size_t at = shape + 1; at < shapeEnd;) {
+    if (std::isdigit(static_cast<unsigned char>(header[at]))) {
+      size_t used;
+      dims.push_back(std::stoull(header.substr(at), &used));
+      at += used;
+    } else {
+      at++;
+    }
+  }
+  if (dims.size() != 2 || dims[1] != DIM) {
+    throw std::runtime_error(".npy shape must be (N, " + std::to_string(DIM) +
+                             ")");
+  }
+
+  stride = DIM * sizeof(float);
+  count = dims[0];
+  vectors = mapping + headerStart + headerLength;
+  if (headerStart + headerLength + count * stride > mappingSize) {
+    throw std::runtime_error("Truncated .npy data");
+  }
+}
+
+/**
+ * next
+ * Builds the next batch of Data, then lets the kernel drop the mapped pages
+ * that were consumed.
+ * @param batch: Output, cleared and filled with the new Data. If a record
+ * is malformed, the entries built before it stay in the batch and are
+ * released with it.
+ * @param batchSize: Maximum number of entries.
+ * @return bool: True if the batch holds any entry.
+ */
+bool EmbeddingReader::next(std::vector<std::unique_ptr<Data>> &batch,
+                           size_t batchSize) {
+  batch.clear();
+  size_t end = std::min(count, position + batchSize);
+  batch.reserve(end - position);
+
+  for (; position < end; ++position) {
+    const char *record = vectors + position * stride;
+    if (format == FVECS) {
+      int32_t dimension;
+      std::memcpy(&dimension, record - sizeof(int32_t), sizeof(dimension));
+      if (dimension != static_cast<int32_t>(DIM)) {
+        throw std::runtime_error("fvecs vector " + std::to_string(position) +
+                                 " has dimension " + std::to_string(dimension));
+      }
+    }
+
+    std::string path;
+    if (paths.is_open()) {
+      if (!std::getline(paths, path)) {
+        throw std::runtime_error("Path list is shorter than the embeddings");
+      }
+    } else {
+      path = std::to_string(position);
+    }
+    batch.push_back(std::make_unique<Data>(
+            Point(reinterpret_cast<const float *>(record)), std::move(path)));
+  }
+
+  // Release the whole pages behind the current position
+  auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t consumed = static_cast<size_t>(vectors - mapping) + position * stride;
+  size_t releasable = consumed / pageSize * pageSize;
+  if (releasable > released) {
+    madvise(const_cast<char *>(mapping) + released, releasable - released,
+            MADV_DONTNEED);
+    released = releasable;
+  }
+  return !batch.empty();
+}
+
+/**
+ * ingest
+ * Inserts every remaining vector into a tree, one batch at a time.
+ * @param tree: Destination tree.
+ * @param batchSize: Vectors per batch.
+ * @return std::vector<Data *>: The inserted Data, owned by the caller.
+ * If reading fails, the entries inserted so far are removed from the tree
+ * and freed before the error is rethrown; one the tree cannot find is kept
+ * alive rather than left dangling.
+ */
+std::vector<Data *> EmbeddingReader::ingest(SSTree &tree, size_t batchSize) {
+  std::vector<std::unique_ptr<Data>> inserted;
+  inserted.reserve(remaining());
+  std::vector<std::unique_ptr<Data>> batch;
+  try {
+    while (next(batch, batchSize)) {
+      for (auto &d: batch) {
+        tree.insert(d.get());
+        inserted.push_back(std::move(d));
+      }
+    }
+  } catch (...) {
+    for (auto &d: inserted) {
+      if (!tree.remove(d.get())) {
+        d.release(); // Still linked from the tree, so it must outlive it
+      }
+    }
+    throw;
+  }
+
+  std::vector<Data *> result;
+  result.reserve(inserted.size());
+  for (auto &d: inserted) {
+    result.push_back(d.release());
+  }
+  return result;
+}
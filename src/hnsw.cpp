@@ -0,0 +1,333 @@
+#include "hnsw.h"
+#include <cmath>
+#include <queue>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+/**
+ * VisitedList
+ * Per-thread visited marks for searchLayer. Marks are versioned, so starting
+ * a new search is O(1) instead of clearing the whole array.
+ */
+struct VisitedList {
+    std::vector<uint32_t> tags;
+    uint32_t current = 0;
+
+    void reset(size_t size) {
+      if (tags.size() < size) {
+        tags.resize(size, 0);
+      }
+      if (++current == 0) {
+        std::fill(tags.begin(), tags.end(), 0);
+        current = 1;
+      }
+    }
+
+    // Returns true the first time an id is visited
+    bool visit(uint32_t id) {
+      if (tags[id] == current) {
+        return false;
+      }
+      tags[id] = current;
+      return true;
+    }
+};
+
+static thread_local VisitedList visitedList;
+
+HNSW::HNSW(size_t M, size_t efConstruction, size_t efSearch, unsigned seed)
+        : M(std::max<size_t>(M, 2)), maxM0(2 * std::max<size_t>(M, 2)),
+          efConstruction(std::max(efConstruction, M)), efSearch(efSearch),
+          levelMultiplier(1.0 / std::log(static_cast<double>(
+                  std::max<size_t>(M, 2)))),
+          entryPoint(NONE), maxLevel(0), levelGenerator(seed) {}
+
+/**
+ * randomLevel
+ * Draws the top layer of a new entry from an exponentially decaying
+ * distribution, so each layer holds about 1/M of the one below.
+ * @return size_t: Top layer for the new entry.
+ */
+size_t HNSW::randomLevel() {
+  std::uniform_real_distribution<double> dis(0.0, 1.0);
+  double r = -std::log(1.0 - dis(levelGenerator)) * levelMultiplier;
+  return static_cast<size_t>(r);
+}
+
+/**
+ * distance
+ * Squared distance between a query and an indexed entry. Squared distances
+ * keep the same ordering and skip the square root.
+ */
+float HNSW::distance(const Point &query, uint32_t id) const {
+  return query.distanceSquared(nodes[id]->data->getEmbedding());
+}
+
+uint32_t HNSW::addNode(Data *_data) {
+  nodes.push_back(std::make_unique<Node>(_data, randomLevel()));
+  return static_cast<uint32_t>(nodes.size() - 1);
+}
+
+/**
+ * greedyClosest
+ * Walks the upper layers greedily, moving to any neighbor closer to the query.
+ * @param query: Target point.
+ * @param entry: Starting entry.
+ * @param fromLevel: Highest layer to walk.
+ * @param toLevel: Layer where the walk stops (not walked).
+ * @return uint32_t: Closest entry found at layer toLevel + 1.
+ */
+uint32_t HNSW::greedyClosest(const Point &query, uint32_t entry,
+                             size_t fromLevel, size_t toLevel) const {
+  float best = distance(query, entry);
+  for (size_t layer = fromLevel; layer > toLevel; --layer) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      Node &node = *nodes[entry];
+      std::lock_guard<std::mutex> guard(node.lock);
+      for (uint32_t neighbor: node.neighbors[layer]) {
+        float dist = distance(query, neighbor);
+        if (dist < best) {
+          best = dist;
+          entry = neighbor;
+          changed = true;
+        }
+      }
+    }
+  }
+  return entry;
+}
+
+/**
+ * searchLayer
+ * Beam search on a single layer keeping the ef closest entries found.
+ * @param query: Target point.
+ * @param entry: Starting entry.
+ * @param ef: Size of the dynamic candidate list.
+ * @param layer: Layer to search.
+ * @return std::vector<Candidate>: Up to ef (squared distance, id) pairs.
+ */
+std::vector<HNSW::Candidate>
+HNSW::searchLayer(const Point &query, uint32_t entry, size_t ef,
+                  size_t layer) const {
+  visitedList.reset(nodes.size());
+
+  std::priority_queue<Candidate, std::vector<Candidate>,
+          std::greater<>> candidates;
+  std::priority_queue<Candidate> results;
+
+  float entryDist = distance(query, entry);
+  visitedList.visit(entry);
+  candidates.emplace(entryDist, entry);
+  results.emplace(entryDist, entry);
+
+  while (!candidates.empty()) {
+    auto [dist, current] = candidates.top();
+    if (results.size() >= ef && dist > results.top().first) {
+      break;
+    }
+    candidates.pop();
+
+    Node &node = *nodes[current];
+    std::lock_guard<std::mutex> guard(node.lock);
+    for (uint32_t neighbor: node.neighbors[layer]) {
+      if (!visitedList.visit(neighbor)) {
+        continue;
+      }
+      float neighborDist = distance(query, neighbor);
+      if (results.size() < ef || neighborDist < results.top().first) {
+        candidates.emplace(neighborDist, neighbor);
+        results.emplace(neighborDist, neighbor);
+        if (results.size() > ef) {
+          results.pop();
+        }
+      }
+    }
+  }
+
+  std::vector<Candidate> found;
+  found.reserve(results.size());
+  while (!results.empty()) {
+    found.push_back(results.top());
+    results.pop();
+  }
+  return found;
+}
+
+/**
+ * selectNeighbors
+ * Neighbor selection heuristic: a candidate is kept only if it is closer to
+ * the base point than to every neighbor already kept. This spreads edges in
+ * different directions instead of clustering them.
+ * @param candidates: (squared distance to base, id) pairs.
+ * @param maxNeighbors: Maximum number of neighbors to keep.
+ * @return std::vector<uint32_t>: Selected neighbor ids.
+ */
+std::vector<uint32_t>
+HNSW::selectNeighbors(std::vector<Candidate> candidates,
+                      size_t maxNeighbors) const {
+  std::sort(candidates.begin(), candidates.end());
+
+  std::vector<uint32_t> selected;
+  selected.reserve(maxNeighbors);
+  for (const auto &[dist, id]: candidates) {
+    if (selected.size() >= maxNeighbors) {
+      break;
+    }
+    const Point &embedding = nodes[id]->data->getEmbedding();
+    bool good = true;
+    for (uint32_t kept: selected) {
+      if (distance(embedding, kept) < dist) {
+        good = false;
+        break;
+      }
+    }
+    if (good) {
+      selected.push_back(id);
+    }
+  }
+  return selected;
+}
+
+/**
+ * link
+ * Connects an already added entry to the graph, layer by layer from its top
+ * layer down to layer 0. Only the entry point update takes the global lock.
+ * @param id: Entry to connect.
+ */
+void HNSW::link(uint32_t id) {
+  Node &node = *nodes[id];
+
+  std::unique_lock<std::mutex> global(globalLock);
+  if (entryPoint == NONE) {
+    entryPoint = id;
+    maxLevel = node.level;
+    return;
+  }
+  uint32_t entry = entryPoint;
+  size_t topLevel = maxLevel;
+  // Keep the global lock only if this entry becomes the new entry point
+  if (node.level <= topLevel) {
+    global.unlock();
+  }
+
+  const Point &query = node.data->getEmbedding();
+  if (node.level < topLevel) {
+    entry = greedyClosest(query, entry, topLevel, node.level);
+  }
+
+  for (size_t layer = std::min(node.level, topLevel) + 1; layer-- > 0;) {
+    std::vector<Candidate> candidates = searchLayer(query, entry,
+                                                    efConstruction, layer);
+    std::erase_if(candidates, [id](const Candidate &c) {
+        return c.second == id;
+    });
+    if (candidates.empty()) {
+      continue;
+    }
+    entry = std::min_element(candidates.begin(), candidates.end())->second;
+
+    std::vector<uint32_t> selected = selectNeighbors(candidates, M);
+    {
+      std::lock_guard<std::mutex> guard(node.lock);
+      node.neighbors[layer] = selected;
+    }
+
+    // Add the reverse edges, shrinking lists that grow past their limit
+    for (uint32_t neighborId: selected) {
+      Node &neighbor = *nodes[neighborId];
+      std::lock_guard<std::mutex> guard(neighbor.lock);
+      std::vector<uint32_t> &edges = neighbor.neighbors[layer];
+      if (edges.size() < maxNeighbors(layer)) {
+        edges.push_back(id);
+        continue;
+      }
+
+      const Point &base = neighbor.data->getEmbedding();
+      std::vector<Candidate> pool;
+      pool.reserve(edges.size() + 1);
+      pool.emplace_back(distance(base, id), id);
+      for (uint32_t edge: edges) {
+        pool.emplace_back(distance(base, edge), edge);
+      }
+      edges = selectNeighbors(std::move(pool), maxNeighbors(layer));
+    }
+  }
+
+  if (node.level > topLevel) {
+    entryPoint = id;
+    maxLevel = node.level;
+  }
+}
+
+/**
+ * insert
+ * Inserts a single entry into the graph.
+ * @param _data: Data to be inserted.
+ */
+void HNSW::insert(Data *_data) {
+  link(addNode(_data));
+}
+
+/**
+ * build
+ * Inserts a batch of entries. All nodes are allocated up front, then
+ * numThreads workers link them concurrently using per-node locks.
+ * @param data: Entries to insert.
+ * @param numThreads: Number of worker threads (0 uses all cores).
+ */
+void HNSW::build(const std::vector<Data *> &data, size_t numThreads) {
+  if (numThreads == 0) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  size_t first = nodes.size();
+  nodes.reserve(first + data.size());
+  for (Data *d: data) {
+    addNode(d);
+  }
+
+  std::atomic<size_t> next(first);
+  auto worker = [this, &next]() {
+      for (size_t id = next++; id < nodes.size(); id = next++) {
+        link(static_cast<uint32_t>(id));
+      }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < numThreads; ++t) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread: threads) {
+    thread.join();
+  }
+}
+
+/**
+ * knn
+ * Finds the approximate k nearest neighbors of a query point.
+ * @param query: Query point.
+ * @param k: Number of neighbors.
+ * @return std::vector<Data *>: Neighbors sorted from closest to farthest.
+ */
+std::vector<Data *> HNSW::knn(Point &query, size_t k) {
+  std::vector<Data *> result;
+  if (entryPoint == NONE || k == 0) {
+    return result;
+  }
+
+  uint32_t entry = greedyClosest(query, entryPoint, maxLevel, 0);
+  std::vector<Candidate> candidates = searchLayer(query, entry,
+                                                  std::max(efSearch, k), 0);
+  std::sort(candidates.begin(), candidates.end());
+
+  size_t count = std::min(k, candidates.size());
+  result.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    result.push_back(nodes[candidates[i].second]->data);
+  }
+  return result;
+}
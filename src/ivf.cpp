@@ -0,0 +1,196 @@
+#include "ivf.h"
+#include "parallel.h"
+#include <random>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <algorithm>
+
+/**
+ * nearestCentroid
+ * Finds the list whose centroid is closest to a point.
+ * @param point: Point to assign.
+ * @return size_t: Index of the closest centroid.
+ */
+size_t IVFIndex::nearestCentroid(const Point &point) const {
+  size_t best = 0;
+  float bestDistance = std::numeric_limits<float>::max();
+  for (size_t i = 0; i < centroids.size(); ++i) {
+    float dist = point.distanceSquaredBounded(centroids[i], bestDistance);
+    if (dist < bestDistance) {
+      bestDistance = dist;
+      best = i;
+    }
+  }
+  return best;
+}
+
+void IVFIndex::append(size_t list, Data *_data) {
+  const float *values = _data->getEmbedding().data();
+  lists[list].vectors.insert(lists[list].vectors.end(), values, values + DIM);
+  lists[list].entries.push_back(_data);
+}
+
+/**
+ * train
+ * Runs Lloyd's k-means over the sample. Each iteration assigns the sample
+ * in parallel, with per-thread partial sums that are reduced afterwards.
+ * Empty clusters are reseeded with a random sample point.
+ * @param sample: Entries used for training.
+ * @param iterations: Number of k-means iterations.
+ * @param numThreads: Number of threads (0 uses all cores).
+ * @param seed: Seed for the initial centroids.
+ */
+void IVFIndex::train(const std::vector<Data *> &sample, size_t iterations,
+                     size_t numThreads, unsigned seed) {
+  if (sample.size() < nlist) {
+    throw std::invalid_argument("IVFIndex::train needs at least nlist samples");
+  }
+  numThreads = resolveThreads(numThreads);
+
+  // Initial centroids: nlist distinct sample points
+  std::mt19937 gen(seed);
+  std::vector<size_t> order(sample.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::shuffle(order.begin(), order.end(), gen);
+  centroids.clear();
+  for (size_t i = 0; i < nlist; ++i) {
+    centroids.push_back(sample[order[i]]->getEmbedding());
+  }
+
+  std::vector<std::vector<Point>> sums(numThreads);
+  std::vector<std::vector<size_t>> counts(numThreads);
+  std::uniform_int_distribution<size_t> pick(0, sample.size() - 1);
+
+  for (size_t iteration = 0; iteration < iterations; ++iteration) {
+    parallelFor(0, sample.size(), numThreads,
+                [&](size_t thread, size_t from, size_t to) {
+        sums[thread].assign(nlist, Point());
+        counts[thread].assign(nlist, 0);
+        for (size_t i = from; i < to; ++i) {
+          const Point &embedding = sample[i]->getEmbedding();
+          size_t list = nearestCentroid(embedding);
+          sums[thread][list] += embedding;
+          counts[thread][list]++;
+        }
+    });
+
+    for (size_t list = 0; list < nlist; ++list) {
+      Point sum;
+      size_t count = 0;
+      for (size_t t = 0; t < numThreads; ++t) {
+        if (!sums[t].empty()) {
+          sum += sums[t][list];
+          count += counts[t][list];
+        }
+      }
+      if (count == 0) {
+        centroids[list] = sample[pick(gen)]->getEmbedding();
+      } else {
+        centroids[list] = sum / static_cast<float>(count);
+      }
+    }
+  }
+
+  lists.assign(nlist, InvertedList());
+}
+
+/**
+ * insert
+ * Adds an entry to the list of its nearest centroid.
+ * @param _data: Data to be inserted.
+ */
+void IVFIndex::insert(Data *_data) {
+  if (!isTrained()) {
+    throw std::logic_error("IVFIndex::insert called before train");
+  }
+  append(nearestCentroid(_data->getEmbedding()), _data);
+}
+
+/**
+ * insert
+ * Adds a batch of entries. The nearest-centroid search runs in parallel;
+ * the lists are then filled sequentially in input order.
+ * @param data: Entries to insert.
+ * @param numThreads: Number of threads (0 uses all cores).
+ */
+void IVFIndex::insert(const std::vector<Data *> &data, size_t numThreads) {
+  if (!isTrained()) {
+    throw std::logic_error("IVFIndex::insert called before train");
+  }
+
+  std::vector<size_t> assignment(data.size());
+  parallelFor(0, data.size(), numThreads,
+              [&](size_t, size_t from, size_t to) {
+      for (size_t i = from; i < to; ++i) {
+        assignment[i] = nearestCentroid(data[i]->getEmbedding());
+      }
+  });
+
+  for (size_t i = 0; i < data.size(); ++i) {
+    append(assignment[i], data[i]);
+  }
+}
+
+size_t IVFIndex::size() const {
+  size_t total = 0;
+  for (const auto &list: lists) {
+    total += list.entries.size();
+  }
+  return total;
+}
+
+/**
+ * knn
+ * Finds the approximate k nearest neighbors of a query point.
+ * @param query: Query point.
+ * @param k: Number of neighbors.
+ * @return std::vector<Data *>: Neighbors sorted from closest to farthest.
+ */
+std::vector<Data *> IVFIndex::knn(Point &query, size_t k) {
+  static thread_local Context context;
+
+  std::vector<Data *> result;
+  knn(query, k, context, result);
+  return result;
+}
+
+/**
+ * knn
+ * Scans the nprobe lists closest to the query, abandoning each entry as soon
+ * as its partial distance exceeds the current k-th best.
+ * @param query: Query point.
+ * @param k: Number of neighbors.
+ * @param context: Scratch context reused across queries.
+ * @param result: Output buffer, cleared and filled closest first.
+ */
+void IVFIndex::knn(const Point &query, size_t k, Context &context,
+                   std::vector<Data *> &result) const {
+  context.reset(k);
+  if (!isTrained() || k == 0) {
+    context.drain(result);
+    return;
+  }
+
+  // Select the nprobe closest lists, nearest first
+  size_t probes = std::min(std::max<size_t>(nprobe, 1), nlist);
+  std::vector<std::pair<float, size_t>> order(nlist);
+  for (size_t i = 0; i < nlist; ++i) {
+    order[i] = {query.distanceSquared(centroids[i]), i};
+  }
+  std::partial_sort(order.begin(), order.begin() + probes, order.end());
+
+  for (size_t p = 0; p < probes; ++p) {
+    const InvertedList &list = lists[order[p].second];
+    for (size_t i = 0; i < list.entries.size(); ++i) {
+      float bound = context.full() ? context.worst()
+                                   : std::numeric_limits<float>::max();
+      float dist = query.distanceSquaredBounded(&list.vectors[i * DIM], bound);
+      if (!context.full() || dist < bound) {
+        context.offer(dist, list.entries[i]);
+      }
+    }
+  }
+
+  context.drain(result);
+}
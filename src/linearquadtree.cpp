@@ -0,0 +1,247 @@
+#include "linearquadtree.h"
+#include "parallel.h"
+#include <array>
+#include <algorithm>
+#include <stdexcept>
+
+static constexpr size_t MIN_PARTICLES_PER_THREAD = 1 << 15;
+
+LinearQuadTree::LinearQuadTree(const Rect &boundary, size_t leafSize)
+        : leafSize(std::max<size_t>(leafSize, 1)) {
+    auto value = [](const NType &v) { return static_cast<double>(v.getValue()); };
+    xmin = value(boundary.getPmin().getX());
+    ymin = value(boundary.getPmin().getY());
+    width = value(boundary.getPmax().getX()) - xmin;
+    height = value(boundary.getPmax().getY()) - ymin;
+    if (!(width > 0) || !(height > 0)) {
+        throw std::invalid_argument("LinearQuadTree needs a non-empty boundary");
+    }
+}
+
+// Inserts a zero bit above each of the 16 low bits of v
+static inline uint32_t spreadBits(uint32_t v) {
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+static inline uint32_t quantize(double offset, double extent) {
+    constexpr double CELLS = 1u << LinearQuadTree::LEVELS;
+    double cell = offset / extent * CELLS;
+    if (!(cell > 0)) {
+        return 0;
+    }
+    return cell >= CELLS - 1 ? (1u << LinearQuadTree::LEVELS) - 1
+                             : static_cast<uint32_t>(cell);
+}
+
+/**
+ * mortonCode
+ * Interleaves the quantized coordinates, x in the even bits and y in the
+ * odd ones. Positions outside the boundary are clamped to its edge cells.
+ * @return uint32_t: Code whose top 2L bits identify the level-L cell.
+ */
+uint32_t LinearQuadTree::mortonCode(double x, double y) const {
+    return spreadBits(quantize(x - xmin, width)) |
+           (spreadBits(quantize(y - ymin, height)) << 1);
+}
+
+void LinearQuadTree::build(const ParticleSystem &system, size_t numThreads) {
+    /**
+     * Codes are computed and the sorted positions gathered in parallel
+     * chunks; the radix sort splits each pass the same way. The cells are
+     * then read off the sorted codes.
+     */
+    size_t n = system.size();
+    size_t useful = std::max<size_t>(n / MIN_PARTICLES_PER_THREAD, 1);
+    numThreads = std::min(resolveThreads(numThreads), useful);
+
+    codes.resize(n);
+    order.resize(n);
+    codeBuffer.resize(n);
+    orderBuffer.resize(n);
+    const double *x = system.positionsX().data();
+    const double *y = system.positionsY().data();
+    parallelFor(0, n, numThreads, [this, x, y](size_t, size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) {
+            codes[i] = mortonCode(x[i], y[i]);
+            order[i] = static_cast<Index>(i);
+        }
+    });
+
+    radixSort(numThreads);
+
+    sortedX.resize(n);
+    sortedY.resize(n);
+    parallelFor(0, n, numThreads, [this, x, y](size_t, size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) {
+            sortedX[i] = x[order[i]];
+            sortedY[i] = y[order[i]];
+        }
+    });
+
+    buildCells();
+}
+
+void LinearQuadTree::radixSort(size_t numThreads) {
+    /**
+     * Least-significant-digit radix sort on 8-bit digits. In each pass
+     * every thread counts the digits of its chunk, the counts are turned
+     * into per-thread write offsets (digit-major, then thread), and every
+     * thread scatters its chunk. The sort is stable, so equal codes keep
+     * the particle order. Passes whose digit is the same for every code
+     * are skipped.
+     */
+    constexpr size_t RADIX = 256;
+    size_t n = codes.size();
+    std::vector<std::array<size_t, RADIX>> offsets(numThreads);
+
+    for (unsigned shift = 0; shift < 32; shift += 8) {
+        parallelFor(0, n, numThreads,
+                    [this, &offsets, shift](size_t t, size_t from, size_t to) {
+            offsets[t].fill(0);
+            for (size_t i = from; i < to; ++i) {
+                offsets[t][(codes[i] >> shift) & (RADIX - 1)]++;
+            }
+        });
+
+        size_t total = 0;
+        bool trivial = false;
+        for (size_t digit = 0; digit < RADIX; ++digit) {
+            size_t count = 0;
+            for (auto &threadOffsets: offsets) {
+                size_t c = threadOffsets[digit];
+                threadOffsets[digit] = total + count;
+                count += c;
+            }
+            trivial = trivial || count == n;
+            total += count;
+        }
+        if (trivial) {
+            continue;
+        }
+
+        parallelFor(0, n, numThreads,
+                    [this, &offsets, shift](size_t t, size_t from, size_t to) {
+            auto &next = offsets[t];
+            for (size_t i = from; i < to; ++i) {
+                size_t slot = next[(codes[i] >> shift) & (RADIX - 1)]++;
+                codeBuffer[slot] = codes[i];
+                orderBuffer[slot] = order[i];
+            }
+        });
+        codes.swap(codeBuffer);
+        order.swap(orderBuffer);
+    }
+}
+
+void LinearQuadTree::buildCells() {
+    /**
+     * Breadth-first over the sorted codes: the children of a cell are the
+     * runs of its range with the same next two code bits, found by binary
+     * search. Children are appended together, so a cell only needs the
+     * index of its first child. Empty quadrants get no cell.
+     */
+    cells.clear();
+    cells.push_back({xmin, ymin, xmin + width, ymin + height,
+                     0, static_cast<uint32_t>(codes.size()), 0, 0, 0});
+
+    for (size_t c = 0; c < cells.size(); ++c) {
+        Cell cell = cells[c];
+        if (cell.end - cell.begin <= leafSize || cell.level == LEVELS) {
+            continue;
+        }
+
+        unsigned shift = 2 * (LEVELS - 1 - cell.level);
+        double xmid = (cell.xmin + cell.xmax) / 2;
+        double ymid = (cell.ymin + cell.ymax) / 2;
+        auto firstChild = static_cast<uint32_t>(cells.size());
+        uint8_t numChildren = 0;
+
+        uint32_t from = cell.begin;
+        for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+            auto last = std::partition_point(
+                    codes.begin() + from, codes.begin() + cell.end,
+                    [shift, quadrant](uint32_t code) {
+                        return ((code >> shift) & 3) <= quadrant;
+                    });
+            auto to = static_cast<uint32_t>(last - codes.begin());
+            if (to > from) {
+                bool east = quadrant & 1;
+                bool north = quadrant & 2;
+                cells.push_back({east ? xmid : cell.xmin,
+                                 north ? ymid : cell.ymin,
+                                 east ? cell.xmax : xmid,
+                                 north ? cell.ymax : ymid,
+                                 from, to, 0, 0,
+                                 static_cast<uint8_t>(cell.level + 1)});
+                numChildren++;
+            }
+            from = to;
+        }
+        cells[c].firstChild = firstChild;
+        cells[c].numChildren = numChildren;
+    }
+}
+
+static inline double minDistSquared(double x, double y,
+                                    const LinearQuadTree::Cell &cell) {
+    double dx = std::max({cell.xmin - x, 0.0, x - cell.xmax});
+    double dy = std::max({cell.ymin - y, 0.0, y - cell.ymax});
+    return dx * dx + dy * dy;
+}
+
+std::vector<LinearQuadTree::Index>
+LinearQuadTree::knn(const Point2D &queryPoint, size_t k) const {
+    static thread_local LinearKnnContext context;
+
+    std::vector<Index> result;
+    knn(queryPoint, k, context, result);
+    return result;
+}
+
+void LinearQuadTree::knn(const Point2D &queryPoint, size_t k,
+                         LinearKnnContext &context,
+                         std::vector<Index> &result) const {
+    /**
+     * Best-first search on squared distances. Leaves scan their run of the
+     * sorted position arrays, and the search stops once the closest pending
+     * cell is farther than the current k-th neighbor.
+     */
+    context.reset(k);
+    if (cells.empty() || k == 0) {
+        result.clear();
+        return;
+    }
+    double qx = static_cast<double>(queryPoint.getX().getValue());
+    double qy = static_cast<double>(queryPoint.getY().getValue());
+
+    context.pushClosest(0.0, &cells[0]);
+    while (context.hasPending()) {
+        auto [bound, cell] = context.popClosest();
+        if (context.full() && bound > context.worst()) {
+            break;
+        }
+
+        if (cell->isLeaf()) {
+            for (uint32_t i = cell->begin; i < cell->end; ++i) {
+                double dx = sortedX[i] - qx;
+                double dy = sortedY[i] - qy;
+                context.offer(dx * dx + dy * dy, order[i]);
+            }
+        } else {
+            for (uint32_t c = 0; c < cell->numChildren; ++c) {
+                const Cell &child = cells[cell->firstChild + c];
+                double childBound = minDistSquared(qx, qy, child);
+                if (!context.full() || childBound <= context.worst()) {
+                    context.pushClosest(childBound, &child);
+                }
+            }
+        }
+    }
+
+    context.drain(result);
+}
@@ -0,0 +1,256 @@
+#include "lsh.h"
+#include <cmath>
+#include <queue>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+
+LSHIndex::LSHIndex(LSHFamily family, size_t numTables, size_t numHashes,
+                   float bucketWidth, size_t numProbes, unsigned seed)
+        : family(family), numHashes(numHashes), bucketWidth(bucketWidth),
+          numProbes(numProbes), tables(numTables) {
+  if (numTables == 0 || numHashes == 0) {
+    throw std::invalid_argument("LSHIndex needs at least one table and hash");
+  }
+  if (!(bucketWidth > 0.0f)) {
+    throw std::invalid_argument("LSHIndex needs a positive bucket width");
+  }
+
+  std::mt19937 gen(seed);
+  std::normal_distribution<float> gaussian(0.0f, 1.0f);
+  std::uniform_real_distribution<float> uniform(0.0f, bucketWidth);
+
+  for (size_t t = 0; t < numTables; ++t) {
+    Eigen::MatrixXf projection(this->numHashes, DIM);
+    for (Eigen::Index i = 0; i < projection.size(); ++i) {
+      projection.data()[i] = gaussian(gen);
+    }
+    projections.push_back(std::move(projection));
+
+    Eigen::VectorXf offset = Eigen::VectorXf::Zero(this->numHashes);
+    if (family == EUCLIDEAN) {
+      for (size_t i = 0; i < this->numHashes; ++i) {
+        offset[i] = uniform(gen);
+      }
+    }
+    offsets.push_back(std::move(offset));
+  }
+}
+
+/**
+ * hashValues
+ * Computes the numHashes hash values of a point for one table, plus the
+ * margins multi-probe needs: for COSINE the distance of each projection to
+ * zero; for EUCLIDEAN the distances to the lower and upper bucket borders.
+ * @param table: Table index.
+ * @param point: Point to hash.
+ * @param values: Output hash values.
+ * @param margins: Output margins.
+ */
+void LSHIndex::hashValues(size_t table, const Point &point,
+                          std::vector<int64_t> &values,
+                          std::vector<float> &margins) const {
+  Eigen::Map<const Eigen::VectorXf> coordinates(point.data(), DIM);
+  Eigen::VectorXf projected = projections[table] * coordinates;
+
+  values.resize(numHashes);
+  margins.clear();
+  for (size_t i = 0; i < numHashes; ++i) {
+    if (family == COSINE) {
+      values[i] = projected[i] >= 0.0f ? 1 : 0;
+      margins.push_back(std::abs(projected[i]));
+    } else {
+      float scaled = (projected[i] + offsets[table][i]) / bucketWidth;
+      float bucket = std::floor(scaled);
+      values[i] = static_cast<int64_t>(bucket);
+      margins.push_back((scaled - bucket) * bucketWidth);
+      margins.push_back((1.0f - (scaled - bucket)) * bucketWidth);
+    }
+  }
+}
+
+uint64_t LSHIndex::key(const std::vector<int64_t> &values) const {
+  uint64_t h = 0;
+  for (int64_t v: values) {
+    h ^= static_cast<uint64_t>(v) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  }
+  return h;
+}
+
+/**
+ * probeKeys
+ * Generates the query bucket key followed by up to numProbes perturbed keys,
+ * in increasing order of perturbation score (sum of squared margins), as in
+ * query-directed multi-probe LSH. A perturbation flips one sign bit (COSINE)
+ * or moves one hash value to the neighboring bucket (EUCLIDEAN).
+ * @param values: Hash values of the query.
+ * @param margins: Margins returned by hashValues.
+ * @param keys: Output keys, the exact bucket first.
+ */
+void LSHIndex::probeKeys(const std::vector<int64_t> &values,
+                         const std::vector<float> &margins,
+                         std::vector<uint64_t> &keys) const {
+  keys.clear();
+  keys.push_back(key(values));
+  if (numProbes == 0) {
+    return;
+  }
+
+  // Candidate single perturbations: (score, hash index, delta)
+  struct Perturbation {
+      float score;
+      size_t hash;
+      int64_t delta;
+  };
+  std::vector<Perturbation> perturbations;
+  for (size_t m = 0; m < margins.size(); ++m) {
+    if (family == COSINE) {
+      perturbations.push_back({margins[m] * margins[m], m, 0});
+    } else {
+      perturbations.push_back({margins[m] * margins[m], m / 2,
+                               m % 2 == 0 ? -1 : 1});
+    }
+  }
+  std::sort(perturbations.begin(), perturbations.end(),
+            [](const Perturbation &a, const Perturbation &b) {
+                return a.score < b.score;
+            });
+
+  // Best-first enumeration of perturbation sets via shift/expand
+  using Set = std::pair<float, std::vector<size_t>>;
+  auto compare = [](const Set &a, const Set &b) { return a.first > b.first; };
+  std::priority_queue<Set, std::vector<Set>, decltype(compare)> heap(compare);
+  heap.push({perturbations[0].score, {0}});
+
+  std::vector<int64_t> probe;
+  while (!heap.empty() && keys.size() <= numProbes) {
+    Set set = heap.top();
+    heap.pop();
+
+    size_t last = set.second.back();
+    if (last + 1 < perturbations.size()) {
+      Set shifted = set;
+      shifted.first += perturbations[last + 1].score -
+                       perturbations[last].score;
+      shifted.second.back() = last + 1;
+      heap.push(std::move(shifted));
+
+      Set expanded = set;
+      expanded.first += perturbations[last + 1].score;
+      expanded.second.push_back(last + 1);
+      heap.push(std::move(expanded));
+    }
+
+    // A set is valid if it touches each hash value at most once
+    probe = values;
+    std::vector<bool> touched(numHashes, false);
+    bool valid = true;
+    for (size_t index: set.second) {
+      const Perturbation &p = perturbations[index];
+      if (touched[p.hash]) {
+        valid = false;
+        break;
+      }
+      touched[p.hash] = true;
+      probe[p.hash] = family == COSINE ? 1 - probe[p.hash]
+                                       : probe[p.hash] + p.delta;
+    }
+    if (valid) {
+      keys.push_back(key(probe));
+    }
+  }
+}
+
+/**
+ * insert
+ * Adds an entry to its bucket in every table.
+ * @param _data: Data to be inserted.
+ */
+void LSHIndex::insert(Data *_data) {
+  std::vector<int64_t> values;
+  std::vector<float> margins;
+  for (size_t t = 0; t < tables.size(); ++t) {
+    hashValues(t, _data->getEmbedding(), values, margins);
+    tables[t][key(values)].push_back(_data);
+  }
+  count++;
+}
+
+/**
+ * candidates
+ * Collects the entries found in the probed buckets of every table.
+ * @param query: Query point.
+ * @return std::vector<Data *>: Distinct candidate entries.
+ */
+std::vector<Data *> LSHIndex::candidates(const Point &query) const {
+  std::vector<Data *> found;
+  std::vector<int64_t> values;
+  std::vector<float> margins;
+  std::vector<uint64_t> keys;
+
+  for (size_t t = 0; t < tables.size(); ++t) {
+    hashValues(t, query, values, margins);
+    probeKeys(values, margins, keys);
+    for (uint64_t k: keys) {
+      auto it = tables[t].find(k);
+      if (it != tables[t].end()) {
+        found.insert(found.end(), it->second.begin(), it->second.end());
+      }
+    }
+  }
+
+  std::sort(found.begin(), found.end());
+  found.erase(std::unique(found.begin(), found.end()), found.end());
+  return found;
+}
+
+/**
+ * knn
+ * Finds approximate k nearest neighbors by re-ranking the candidates with
+ * the exact distance.
+ * @param query: Query point.
+ * @param k: Number of neighbors.
+ * @return std::vector<Data *>: Up to k neighbors, closest first.
+ */
+std::vector<Data *> LSHIndex::knn(Point &query, size_t k) {
+  std::vector<std::pair<float, Data *>> ranked;
+  for (Data *d: candidates(query)) {
+    ranked.emplace_back(Point::distance(query, d->getEmbedding()), d);
+  }
+
+  size_t count = std::min(k, ranked.size());
+  std::partial_sort(ranked.begin(), ranked.begin() + count, ranked.end());
+
+  std::vector<Data *> result;
+  result.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    result.push_back(ranked[i].second);
+  }
+  return result;
+}
+
+/**
+ * nearDuplicates
+ * Returns the candidates within an exact distance radius of the query,
+ * closest first.
+ * @param query: Query point.
+ * @param radius: Maximum distance.
+ * @return std::vector<Data *>: Matching entries.
+ */
+std::vector<Data *> LSHIndex::nearDuplicates(const Point &query,
+                                             float radius) const {
+  std::vector<std::pair<float, Data *>> matches;
+  for (Data *d: candidates(query)) {
+    float dist = Point::distance(query, d->getEmbedding());
+    if (dist <= radius) {
+      matches.emplace_back(dist, d);
+    }
+  }
+  std::sort(matches.begin(), matches.end());
+
+  std::vector<Data *> result;
+  for (const auto &match: matches) {
+    result.push_back(match.second);
+  }
+  return result;
+}
@@ -0,0 +1,544 @@
+#include "pagedsstree.h"
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Slot layout: DIM floats, one length byte, then the path bytes
+static constexpr size_t SLOT_BYTES = DIM * sizeof(float) + 1 +
+                                     PAGE_PATH_CAPACITY;
+
+/**
+ * encodePage
+ * Serializes the entries of a leaf into a zero-padded page buffer: an entry
+ * count followed by one fixed-size slot per entry.
+ * @param entries: Entries of the leaf.
+ * @param buffer: Page buffer, already sized to the page size.
+ */
+static void encodePage(const std::vector<Data *> &entries,
+                       std::vector<char> &buffer) {
+  std::fill(buffer.begin(), buffer.end(), 0);
+  auto n = static_cast<uint32_t>(entries.size());
+  std::memcpy(buffer.data(), &n, sizeof(n));
+
+  char *slot = buffer.data() + sizeof(n);
+  for (const Data *d: entries) {
+    const std::string &path = d->getPath();
+    if (path.size() > PAGE_PATH_CAPACITY) {
+      throw std::invalid_argument("Image path does not fit in a page: " + path);
+    }
+    std::memcpy(slot, d->getEmbedding().data(), DIM * sizeof(float));
+    slot[DIM * sizeof(float)] = static_cast<char>(path.size());
+    std::memcpy(slot + DIM * sizeof(float) + 1, path.data(), path.size());
+    slot += SLOT_BYTES;
+  }
+}
+
+static LeafPage decodePage(const std::vector<char> &buffer) {
+  uint32_t n;
+  std::memcpy(&n, buffer.data(), sizeof(n));
+
+  LeafPage page;
+  page.entries.reserve(n);
+  const char *slot = buffer.data() + sizeof(n);
+  for (uint32_t i = 0; i < n; ++i) {
+    Eigen::Map<const Eigen::VectorXf> coordinates(
+            reinterpret_cast<const float *>(slot), DIM);
+    auto length = static_cast<unsigned char>(slot[DIM * sizeof(float)]);
+    page.entries.emplace_back(Point(coordinates),
+                              std::string(slot + DIM * sizeof(float) + 1,
+                                          length));
+    slot += SLOT_BYTES;
+  }
+  return page;
+}
+
+static size_t maxLeafSize(const SSNode *node) {
+  if (node->getIsLeaf()) {
+    return node->getData().size();
+  }
+  size_t size = 0;
+  for (const SSNode *child: node->getChildren()) {
+    size = std::max(size, maxLeafSize(child));
+  }
+  return size;
+}
+
+BufferPool::BufferPool(const std::string &path, size_t pageBytes,
+                       size_t capacity)
+        : pageBytes(pageBytes), capacity(capacity) {
+  if (capacity == 0) {
+    throw std::invalid_argument("BufferPool needs room for at least one page");
+  }
+  fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot open page file " + path);
+  }
+}
+
+BufferPool::~BufferPool() {
+  close(fd);
+}
+
+// Reads and decodes a page; safe to call without the lock
+LeafPagePtr BufferPool::readPage(uint32_t page) const {
+  std::vector<char> buffer(pageBytes);
+  auto offset = static_cast<off_t>(page) * static_cast<off_t>(pageBytes);
+  size_t done = 0;
+  while (done < pageBytes) {
+    ssize_t n = pread(fd, buffer.data() + done, pageBytes - done,
+                      offset + static_cast<off_t>(done));
+    if (n <= 0) {
+      throw std::runtime_error("Cannot read page " + std::to_string(page));
+    }
+    done += static_cast<size_t>(n);
+  }
+  return std::make_shared<const LeafPage>(decodePage(buffer));
+}
+
+/**
+ * load
+ * Reads a page that is neither resident nor in flight. The page is marked
+ * in flight and the lock released for the read, then retaken to admit it.
+ * @param page: Page number.
+ * @param guard: Held pool lock; held again on return.
+ * @return LeafPagePtr: Decoded page.
+ */
+LeafPagePtr BufferPool::load(uint32_t page,
+                             std::unique_lock<std::mutex> &guard) {
+  std::promise<LeafPagePtr> promise;
+  inFlight.emplace(page, promise.get_future().share());
+  guard.unlock();
+
+  LeafPagePtr data;
+  try {
+    data = readPage(page);
+  } catch (...) {
+    guard.lock();
+    inFlight.erase(page);
+    promise.set_exception(std::current_exception());
+    throw;
+  }
+
+  guard.lock();
+  inFlight.erase(page);
+  admit(page, data);
+  promise.set_value(data);
+  return data;
+}
+
+// Inserts a page as the most recently used one; the caller holds the lock
+void BufferPool::admit(uint32_t page, const LeafPagePtr &data) {
+  lru.emplace_front(page, data);
+  resident[page] = lru.begin();
+  while (lru.size() > capacity) {
+    resident.erase(lru.back().first);
+    lru.pop_back();
+    stats.evictions++;
+  }
+}
+
+/**
+ * fetch
+ * Returns a page, reading it from the file on a miss and marking it as the
+ * most recently used. A page another query is already reading counts as a
+ * hit and waits for that read.
+ * @param page: Page number.
+ * @return LeafPagePtr: Decoded page.
+ */
+LeafPagePtr BufferPool::fetch(uint32_t page) {
+  std::unique_lock<std::mutex> guard(lock);
+  auto it = resident.find(page);
+  if (it != resident.end()) {
+    stats.hits++;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->second;
+  }
+
+  auto pending = inFlight.find(page);
+  if (pending != inFlight.end()) {
+    stats.hits++;
+    std::shared_future<LeafPagePtr> read = pending->second;
+    guard.unlock();
+    return read.get();
+  }
+
+  stats.misses++;
+  return load(page, guard);
+}
+
+/**
+ * prefetch
+ * Loads the given pages in file order. Read-ahead takes at most a quarter of
+ * the pool, so it never flushes the pages the current queries are using.
+ * @param pages: Candidate pages, most promising first.
+ */
+void BufferPool::prefetch(std::vector<uint32_t> pages) {
+  std::unique_lock<std::mutex> guard(lock);
+  auto loaded = [this](uint32_t p) {
+      return resident.count(p) > 0 || inFlight.count(p) > 0;
+  };
+  pages.erase(std::remove_if(pages.begin(), pages.end(), loaded), pages.end());
+  pages.resize(std::min(pages.size(), capacity / 4));
+  std::sort(pages.begin(), pages.end());
+
+  for (uint32_t page: pages) {
+    // The lock was released by the previous read
+    if (loaded(page)) {
+      continue;
+    }
+    load(page, guard);
+    stats.readAheads++;
+  }
+}
+
+bool BufferPool::isResident(uint32_t page) const {
+  std::lock_guard<std::mutex> guard(lock);
+  return resident.count(page) > 0;
+}
+
+BufferPoolStats BufferPool::getStats() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return stats;
+}
+
+void BufferPool::resetStats() {
+  std::lock_guard<std::mutex> guard(lock);
+  stats = BufferPoolStats();
+}
+
+/**
+ * PagedSSTree
+ * Writes the leaves of an in-memory tree to a page file and keeps its
+ * internal structure. The source tree and its Data can be released once
+ * the paged tree is built.
+ * @param tree: Tree to lay out.
+ * @param path: Page file, overwritten.
+ * @param poolPages: Capacity of the buffer pool, in pages.
+ * @param readAhead: Sibling leaves read ahead on a miss (0 disables it).
+ */
+PagedSSTree::PagedSSTree(const SSTree &tree, const std::string &path,
+                         size_t poolPages, size_t readAhead)
+        : readAhead(readAhead) {
+  const SSNode *root = tree.getRoot();
+  size_t entriesPerPage = root ? std::max<size_t>(maxLeafSize(root), 1) : 1;
+  pageBytes = sizeof(uint32_t) + entriesPerPage * SLOT_BYTES;
+
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error("Cannot create page file " + path);
+    }
+    if (root) {
+      layout(root, 0, out);
+    }
+    if (!out) {
+      throw std::runtime_error("Cannot write page file " + path);
+    }
+  }
+
+  pool = std::make_unique<BufferPool>(path, pageBytes, poolPages);
+}
+
+/**
+ * splitRuns
+ * Splits items[from, to) at the median of the coordinate with the largest
+ * variance until every run holds at most runSize items, and hands the runs
+ * to emit in order. Split points fall on multiples of runSize, so every run
+ * but the last one is full.
+ * @param position: Returns the point of an item.
+ * @param emit: Called with the bounds of each run.
+ */
+template<typename Item, typename Position, typename Emit>
+static void splitRuns(std::vector<Item> &items, size_t from, size_t to,
+                      size_t runSize, Position position, Emit emit) {
+  size_t n = to - from;
+  if (n <= runSize) {
+    emit(from, to);
+    return;
+  }
+
+  Eigen::VectorXf sum = Eigen::VectorXf::Zero(DIM);
+  Eigen::VectorXf sumSquares = Eigen::VectorXf::Zero(DIM);
+  for (size_t i = from; i < to; ++i) {
+    Eigen::Map<const Eigen::VectorXf> p(position(items[i]).data(), DIM);
+    sum += p;
+    sumSquares += p.cwiseProduct(p);
+  }
+  Eigen::VectorXf variance = sumSquares - sum.cwiseProduct(sum) / float(n);
+  Eigen::Index dimension;
+  variance.maxCoeff(&dimension);
+
+  size_t runs = (n + runSize - 1) / runSize;
+  size_t middle = from + runs / 2 * runSize;
+  std::nth_element(items.begin() + from, items.begin() + middle,
+                   items.begin() + to,
+                   [&position, dimension](const Item &a, const Item &b) {
+                       return position(a)[dimension] < position(b)[dimension];
+                   });
+  splitRuns(items, from, middle, runSize, position, emit);
+  splitRuns(items, middle, to, runSize, position, emit);
+}
+
+/**
+ * PagedSSTree
+ * Bulk-loads a paged tree from an embedding file without building it in
+ * memory first. Each batch of the reader is split into leaves of nearby
+ * entries, which are written to pages and released before the next batch
+ * is read, so only one batch and the leaf spheres are held at a time. The
+ * internal levels are then built over the leaf spheres. Leaves only group
+ * entries of the same batch, so larger batches give tighter leaves.
+ * @param reader: Source of the entries; it is read to the end.
+ * @param path: Page file, overwritten.
+ * @param poolPages: Capacity of the buffer pool, in pages.
+ * @param maxPointsPerNode: Entries per leaf and children per internal node.
+ * @param batchSize: Entries read and split at a time.
+ * @param readAhead: Sibling leaves read ahead on a miss (0 disables it).
+ */
+PagedSSTree::PagedSSTree(EmbeddingReader &reader, const std::string &path,
+                         size_t poolPages, size_t maxPointsPerNode,
+                         size_t batchSize, size_t readAhead)
+        : readAhead(readAhead) {
+  if (maxPointsPerNode < 2 || batchSize == 0) {
+    throw std::invalid_argument(
+            "PagedSSTree needs at least two entries per node and a batch");
+  }
+  pageBytes = sizeof(uint32_t) + maxPointsPerNode * SLOT_BYTES;
+
+  std::vector<uint32_t> leaves;
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error("Cannot create page file " + path);
+    }
+    std::vector<std::unique_ptr<Data>> batch;
+    while (reader.next(batch, batchSize)) {
+      writeLeaves(batch, maxPointsPerNode, out, leaves);
+    }
+    if (!out) {
+      throw std::runtime_error("Cannot write page file " + path);
+    }
+  }
+
+  if (!leaves.empty()) {
+    buildUpperLevels(std::move(leaves), maxPointsPerNode);
+  }
+  pool = std::make_unique<BufferPool>(path, pageBytes, poolPages);
+}
+
+/**
+ * writeLeaves
+ * Splits a batch into leaves of nearby entries and writes each one to the
+ * next page.
+ * @param leaves: Receives the indices of the new leaf nodes.
+ */
+void PagedSSTree::writeLeaves(std::vector<std::unique_ptr<Data>> &batch,
+                              size_t entriesPerPage, std::ofstream &out,
+                              std::vector<uint32_t> &leaves) {
+  std::vector<char> buffer(pageBytes);
+  auto position = [](const std::unique_ptr<Data> &d) -> const Point & {
+      return d->getEmbedding();
+  };
+  splitRuns(batch, 0, batch.size(), entriesPerPage, position,
+            [&](size_t from, size_t to) {
+      std::vector<Data *> entries;
+      for (size_t i = from; i < to; ++i) {
+        entries.push_back(batch[i].get());
+      }
+      encodePage(entries, buffer);
+      out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+
+      Point center;
+      for (const Data *d: entries) {
+        center += d->getEmbedding();
+      }
+      center /= static_cast<float>(entries.size());
+      float radius = 0.0f;
+      for (const Data *d: entries) {
+        radius = std::max(radius, Point::distance(center, d->getEmbedding()));
+      }
+
+      leaves.push_back(static_cast<uint32_t>(nodes.size()));
+      nodes.push_back({center, radius, true,
+                       static_cast<uint32_t>(numPages++), {}, 0});
+      count += entries.size();
+  });
+}
+
+/**
+ * buildUpperLevels
+ * Groups the nodes of each level into parents of nearby spheres until a
+ * single root is left. Nodes are created bottom-up, so the node order is
+ * reversed at the end to put the root first.
+ * @param level: Leaf nodes.
+ * @param fanout: Children per internal node.
+ */
+void PagedSSTree::buildUpperLevels(std::vector<uint32_t> level,
+                                   size_t fanout) {
+  auto position = [this](uint32_t node) -> const Point & {
+      return nodes[node].center;
+  };
+  while (level.size() > 1) {
+    std::vector<uint32_t> parents;
+    splitRuns(level, 0, level.size(), fanout, position,
+              [&](size_t from, size_t to) {
+        Point center;
+        for (size_t i = from; i < to; ++i) {
+          center += nodes[level[i]].center;
+        }
+        center /= static_cast<float>(to - from);
+        float radius = 0.0f;
+        for (size_t i = from; i < to; ++i) {
+          const PagedNode &child = nodes[level[i]];
+          radius = std::max(radius, Point::distance(center, child.center) +
+                                    child.radius);
+        }
+
+        auto parent = static_cast<uint32_t>(nodes.size());
+        for (size_t i = from; i < to; ++i) {
+          nodes[level[i]].parent = parent;
+        }
+        nodes.push_back({center, radius, false, 0,
+                         {level.begin() + from, level.begin() + to}, 0});
+        parents.push_back(parent);
+    });
+    level = std::move(parents);
+  }
+
+  auto last = static_cast<uint32_t>(nodes.size() - 1);
+  std::reverse(nodes.begin(), nodes.end());
+  for (PagedNode &node: nodes) {
+    node.parent = last - node.parent;
+    for (uint32_t &child: node.children) {
+      child = last - child;
+    }
+  }
+  nodes[0].parent = 0;
+}
+
+/**
+ * layout
+ * Copies a subtree depth-first, writing every leaf to the next page.
+ * @return uint32_t: Index of the copied node.
+ */
+uint32_t PagedSSTree::layout(const SSNode *node, uint32_t parent,
+                             std::ofstream &out) {
+  auto index = static_cast<uint32_t>(nodes.size());
+  nodes.push_back({node->getCenter(), node->getRadius(), node->getIsLeaf(), 0,
+                   {}, parent});
+
+  if (node->getIsLeaf()) {
+    std::vector<char> buffer(pageBytes);
+    encodePage(node->getData(), buffer);
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    nodes[index].page = static_cast<uint32_t>(numPages++);
+    count += node->getData().size();
+    return index;
+  }
+
+  for (const SSNode *child: node->getChildren()) {
+    uint32_t childIndex = layout(child, index, out);
+    nodes[index].children.push_back(childIndex);
+  }
+  return index;
+}
+
+/**
+ * readAheadSiblings
+ * On a miss, loads the sibling leaves that may still hold neighbors, closest
+ * sphere first, up to readAhead pages.
+ * @param query: Query point.
+ * @param leaf: Leaf that missed.
+ * @param bound: Current k-th best distance.
+ */
+void PagedSSTree::readAheadSiblings(const Point &query, const PagedNode &leaf,
+                                    float bound) {
+  if (readAhead == 0 || &leaf == &nodes[0]) {
+    return;
+  }
+
+  std::vector<std::pair<float, uint32_t>> candidates;
+  for (uint32_t sibling: nodes[leaf.parent].children) {
+    const PagedNode &node = nodes[sibling];
+    if (&node == &leaf || !node.isLeaf) {
+      continue;
+    }
+    float lowerBound = Point::distance(query, node.center) - node.radius;
+    if (lowerBound <= bound) {
+      candidates.emplace_back(lowerBound, node.page);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end());
+  candidates.resize(std::min(candidates.size(), readAhead));
+
+  std::vector<uint32_t> pages;
+  for (const auto &candidate: candidates) {
+    pages.push_back(candidate.second);
+  }
+  pool->prefetch(pages);
+}
+
+/**
+ * knn
+ * Best-first k nearest neighbor search: nodes are visited in order of the
+ * distance from the query to their spheres, so only the leaves that can
+ * still improve the result are paged in.
+ * @param query: Query point.
+ * @param k: Number of neighbors.
+ * @return std::vector<Data>: Neighbors, closest first.
+ */
+std::vector<Data> PagedSSTree::knn(const Point &query, size_t k) {
+  using PagedEntry = std::pair<LeafPagePtr, uint32_t>;
+
+  std::vector<Data> result;
+  if (nodes.empty() || k == 0) {
+    return result;
+  }
+
+  KnnContext<float, PagedEntry, const PagedNode> context(k);
+  context.pushClosest(0.0f, &nodes[0]);
+
+  while (context.hasPending()) {
+    auto [lowerBound, node] = context.popClosest();
+    float bound = context.full() ? context.worst()
+                                 : std::numeric_limits<float>::max();
+    if (lowerBound > bound) {
+      break;
+    }
+
+    if (!node->isLeaf) {
+      for (uint32_t child: node->children) {
+        const PagedNode &next = nodes[child];
+        float childBound = std::max(
+                0.0f, Point::distance(query, next.center) - next.radius);
+        if (childBound <= bound) {
+          context.pushClosest(childBound, &next);
+        }
+      }
+      continue;
+    }
+
+    bool missed = !pool->isResident(node->page);
+    LeafPagePtr page = pool->fetch(node->page);
+    if (missed) {
+      readAheadSiblings(query, *node, bound);
+    }
+
+    for (uint32_t slot = 0; slot < page->entries.size(); ++slot) {
+      float boundSquared = context.full()
+                           ? context.worst() * context.worst()
+                           : std::numeric_limits<float>::max();
+      float distSquared = query.distanceSquaredBounded(
+              page->entries[slot].getEmbedding(), boundSquared);
+      if (distSquared < boundSquared) {
+        context.offer(std::sqrt(distSquared), {page, slot});
+      }
+    }
+  }
+
+  context.drain(result, [](const PagedEntry &entry) {
+      return entry.first->entries[entry.second];
+  });
+  return result;
+}
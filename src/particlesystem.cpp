@@ -0,0 +1,90 @@
+#include "particlesystem.h"
+#include "parallel.h"
+#include <cmath>
+
+
+void ParticleSystem::reserve(size_t n) {
+    posX.reserve(n);
+    posY.reserve(n);
+    velX.reserve(n);
+    velY.reserve(n);
+}
+
+ParticleSystem::Index
+ParticleSystem::add(const Point2D &position, const Point2D &velocity) {
+    auto index = static_cast<Index>(posX.size());
+    posX.push_back(static_cast<double>(position.getX().getValue()));
+    posY.push_back(static_cast<double>(position.getY().getValue()));
+    velX.push_back(static_cast<double>(velocity.getX().getValue()));
+    velY.push_back(static_cast<double>(velocity.getY().getValue()));
+    return index;
+}
+
+ParticleSystem::Index ParticleSystem::add(const Particle &particle) {
+    return add(particle.getPosition(), particle.getVelocity());
+}
+
+/**
+ * reflectAxis
+ * Advances one coordinate by dt inside [lo, lo + length] with elastic
+ * reflection, in closed form and without branches: the motion is unfolded
+ * onto a line, folded back with period 2 * length, and the velocity flips
+ * when the number of wall hits is odd. Any number of bounces per step costs
+ * the same.
+ */
+static inline void reflectAxis(double &position, double &velocity, double dt,
+                               double lo, double length, double invLength) {
+    double unfolded = (position - lo) + velocity * dt;
+    double hits = std::floor(unfolded * invLength);
+    double offset = unfolded - hits * length;
+    double odd = hits - 2.0 * std::floor(hits * 0.5);
+    position = lo + offset + odd * (length - 2.0 * offset);
+    velocity *= 1.0 - 2.0 * odd;
+}
+
+void ParticleSystem::updatePosition(Index i, const Rect &boundary) {
+    integrate(boundary, i, i + 1);
+}
+
+/**
+ * integrate
+ * Advances the particles in [from, to) by one time step. The loop body is
+ * straight-line arithmetic over the SoA arrays, so the compiler can map it
+ * onto SIMD lanes.
+ */
+void ParticleSystem::integrate(const Rect &boundary, size_t from, size_t to) {
+    auto value = [](const NType &v) { return static_cast<double>(v.getValue()); };
+    const double dt = value(Particle::getTimeStep());
+    const double xmin = value(boundary.getPmin().getX());
+    const double ymin = value(boundary.getPmin().getY());
+    const double width = value(boundary.getPmax().getX()) - xmin;
+    const double height = value(boundary.getPmax().getY()) - ymin;
+    const double invWidth = width > 0 ? 1.0 / width : 0.0;
+    const double invHeight = height > 0 ? 1.0 / height : 0.0;
+
+    double *__restrict px = posX.data();
+    double *__restrict py = posY.data();
+    double *__restrict vx = velX.data();
+    double *__restrict vy = velY.data();
+    for (size_t i = from; i < to; ++i) {
+        reflectAxis(px[i], vx[i], dt, xmin, width, invWidth);
+        reflectAxis(py[i], vy[i], dt, ymin, height, invHeight);
+    }
+}
+
+/**
+ * updatePositions
+ * Integrates every particle, splitting the arrays into contiguous chunks
+ * across threads. Small systems stay on the calling thread.
+ * @param boundary: Reflecting walls.
+ * @param numThreads: Number of threads (0 uses all cores).
+ */
+void ParticleSystem::updatePositions(const Rect &boundary, size_t numThreads) {
+    constexpr size_t MIN_PARTICLES_PER_THREAD = 1 << 15;
+    size_t useful = std::max<size_t>(size() / MIN_PARTICLES_PER_THREAD, 1);
+    numThreads = std::min(resolveThreads(numThreads), useful);
+    parallelFor(0, size(), numThreads, [this, &boundary](size_t, size_t from,
+                                                         size_t to) {
+        integrate(boundary, from, to);
+    });
+}
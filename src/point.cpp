@@ -1,6 +1,7 @@
 #include <iostream>
 #include <cmath>
 #include <random>
+#include <algorithm>
 
 #include "point.h"
 #include "rect.h"
@@ -109,6 +110,30 @@ Point &Point::operator/=(float scalar) {
   return *this;
 }
 
+// Distancia con abandono temprano
+float Point::distanceSquaredBounded(const Point &other, float bound) const {
+  return distanceSquaredBounded(other.data(), bound);
+}
+
+float Point::distanceSquaredBounded(const float *other, float bound) const {
+  // Bloques múltiplos del ancho SIMD (8 floats en AVX) para que Eigen
+  // vectorice cada bloque y la comparación con bound sea poco frecuente
+  constexpr std::size_t CHUNK = 32;
+  const std::size_t n = coordinates_.size();
+  Eigen::Map<const Eigen::VectorXf> values(other, n);
+
+  float sum = 0.0f;
+  for (std::size_t i = 0; i < n; i += CHUNK) {
+    std::size_t len = std::min(CHUNK, n - i);
+    sum += (coordinates_.segment(i, len) - values.segment(i, len))
+            .squaredNorm();
+    if (sum > bound) {
+      return sum;
+    }
+  }
+  return sum;
+}
+
 // Punto aleatorio
 Point Point::random(float min, float max) {
   static std::random_device rd;
@@ -3,14 +3,28 @@
 #include <iostream>
 #include <set>
 #include <vector>
+#include <algorithm>
+#include <stdexcept>
 
 
-bool QuadNode::insert(const std::shared_ptr<Particle> &particle) {
+void QuadNode::init(const Rect &_boundary, uint32_t _self, uint32_t _parent,
+                    QuadNodePool *_pool, std::vector<LeafCell> *_owners) {
+    particles.clear();
+    boundary = _boundary;
+    pool = _pool;
+    owners = _owners;
+    self = _self;
+    parent = _parent;
+    firstChild = NONE;
+    _isLeaf = true;
+}
+
+bool QuadNode::insert(Index particle, const ParticleSystem &system) {
     /**
      * Check if the particle is within the rect of this node.
      * If the particle is outside the rect, return false.
      */
-    if (!boundary.contains(particle->getPosition())) {
+    if (!boundary.contains(system.getPosition(particle))) {
         return false;
     }
 
@@ -23,10 +37,10 @@ bool QuadNode::insert(const std::shared_ptr<Particle> &particle) {
             addToBucket(particle);
             return true;
         }
-        subdivide();
-        return propagate(particle);
+        subdivide(system);
+        return propagate(particle, system);
     } else {
-        return propagate(particle);
+        return propagate(particle, system);
     }
 
     /**
@@ -36,60 +50,185 @@ bool QuadNode::insert(const std::shared_ptr<Particle> &particle) {
 }
 
 
-void QuadNode::updateNode() {
+void QuadNode::updateNode(const ParticleSystem &system) {
+    updateWithin(system, nullptr, nullptr);
+}
+
+void QuadNode::updateNode(const ParticleSystem &system,
+                          std::vector<Index> &migrants) {
+    updateWithin(system, this, &migrants);
+}
+
+void QuadNode::updateWithin(const ParticleSystem &system, const QuadNode *top,
+                            std::vector<Index> *migrants) {
     /**
-     * This function would typically be used to update the state of the node,
-     * such as recalculating bounds or updating particle positions.
-     * The implementation is dependent on specific needs.
+     * Moves the particles that left their leaf to the right node. Every
+     * leaving particle is detached first, so no bucket holds a stale
+     * particle when a relocation subdivides a leaf. When top is set, the
+     * update never touches nodes outside top's subtree: a particle that
+     * leaves it is appended to migrants instead, so disjoint subtrees can
+     * be updated concurrently.
      */
+    std::vector<std::pair<QuadNode *, Index>> leaving;
+    detachLeaving(system, leaving);
+    for (auto &[leaf, particle]: leaving) {
+        leaf->relocateParticle(particle, system, top, migrants);
+    }
+}
+
+void QuadNode::detachLeaving(const ParticleSystem &system,
+                             std::vector<std::pair<QuadNode *, Index>> &leaving) {
     if (_isLeaf) {
-        std::vector<std::shared_ptr<Particle>> particlesToRelocate;
-        std::vector<std::shared_ptr<Particle>> particlesToStay;
-        for (const auto &particle: particles) {
-            if (!boundary.contains(particle->getPosition())) {
-                particlesToRelocate.push_back(particle);
-            } else {
-                particlesToStay.push_back(particle);
-            }
+        auto stay = std::partition(particles.begin(), particles.end(),
+                                   [this, &system](Index particle) {
+            return boundary.contains(system.getPosition(particle));
+        });
+        for (auto it = stay; it != particles.end(); ++it) {
+            leaving.emplace_back(this, *it);
         }
-        particles = particlesToStay;
-        for (const auto &particle: particlesToRelocate) {
-            relocateParticle(particle);
+        particles.erase(stay, particles.end());
+    } else {
+        for (QuadNode *child: getChildren()) {
+            child->detachLeaving(system, leaving);
         }
+    }
+}
 
-    } else {
-        for (auto &child: children) {
-            if (child) {
-                child->updateNode();
+void QuadNode::relocate(Index particle, const ParticleSystem &system) {
+    /**
+     * Nothing to do if the particle is still inside, which also covers a
+     * particle already moved here by a subdivision.
+     */
+    if (boundary.contains(system.getPosition(particle))) {
+        return;
+    }
+    auto it = std::find(particles.begin(), particles.end(), particle);
+    if (it == particles.end()) {
+        return;
+    }
+    *it = particles.back();
+    particles.pop_back();
+    relocateParticle(particle, system);
+}
+
+bool QuadNode::mergeChildren(size_t threshold) {
+    /**
+     * Turns this node back into a leaf when all its children are leaves
+     * holding at most threshold particles together. The threshold sits
+     * below bucketSize, so a node does not split and merge on alternate
+     * frames when its count hovers around the bucket size.
+     */
+    if (_isLeaf) {
+        return false;
+    }
+    auto children = getChildren();
+    size_t total = 0;
+    for (QuadNode *child: children) {
+        if (!child->_isLeaf) {
+            return false;
+        }
+        total += child->particles.size();
+    }
+    if (total > threshold) {
+        return false;
+    }
+
+    _isLeaf = true;
+    for (QuadNode *child: children) {
+        for (Index particle: child->particles) {
+            addToBucket(particle);
+        }
+    }
+    pool->freeGroup(firstChild);
+    firstChild = NONE;
+    return true;
+}
+
+size_t QuadNode::depth() const {
+    size_t levels = 0;
+    for (const QuadNode *node = parentNode(); node; node = node->parentNode()) {
+        levels++;
+    }
+    return levels;
+}
+
+void QuadNode::collapse(size_t threshold, size_t maxDepth) {
+    if (_isLeaf) {
+        return;
+    }
+    if (maxDepth > 0) {
+        for (QuadNode *child: getChildren()) {
+            child->collapse(threshold, maxDepth - 1);
+        }
+    }
+    mergeChildren(threshold);
+}
+
+void QuadNode::collapseParents(const std::vector<QuadNode *> &nodes,
+                               size_t threshold) {
+    /**
+     * Parents are tried deepest level first, and a successful merge queues
+     * the next parent up. A node is only deleted when its parent merges,
+     * which happens after every node of its own level was handled, so no
+     * queued pointer dangles.
+     */
+    std::vector<std::vector<QuadNode *>> levels;
+    for (QuadNode *node: nodes) {
+        if (QuadNode *parent = node->parentNode()) {
+            size_t level = parent->depth();
+            if (levels.size() <= level) {
+                levels.resize(level + 1);
+            }
+            levels[level].push_back(parent);
+        }
+    }
+    for (size_t level = levels.size(); level-- > 0;) {
+        std::vector<QuadNode *> &candidates = levels[level];
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                         candidates.end());
+        for (QuadNode *node: candidates) {
+            if (node->mergeChildren(threshold) && node->parentNode()) {
+                levels[level - 1].push_back(node->parentNode());
             }
         }
     }
 }
 
-void QuadNode::addToBucket(const std::shared_ptr<Particle> &particle) {
+void QuadNode::addToBucket(Index particle) {
     /**
      * This function adds a particle to the current node's particle list.
      * It is assumed to be called after the particle has been propagated
      * or if the particle needs to remain in this node.
      */
     particles.push_back(particle);
+    if (owners) {
+        auto value = [](const NType &v) {
+            return static_cast<double>(v.getValue());
+        };
+        (*owners)[particle] = {this,
+                               value(boundary.getPmin().getX()),
+                               value(boundary.getPmin().getY()),
+                               value(boundary.getPmax().getX()),
+                               value(boundary.getPmax().getY())};
+    }
 }
 
-bool QuadNode::propagate(const std::shared_ptr<Particle> &particle) {
+bool QuadNode::propagate(Index particle, const ParticleSystem &system) {
     /**
      * This function attempts to insert the particle into one of the children nodes.
      * It is called if the current node is not a leaf.
      * If the particle is successfully inserted into a child node, return true.
      */
-    for (auto &child: children) {
-        if (child->insert(particle)) {
+    for (QuadNode *child: getChildren()) {
+        if (child->insert(particle, system)) {
             return true;
         }
     }
     return false;
 }
 
-void QuadNode::subdivide() {
+void QuadNode::subdivide(const ParticleSystem &system) {
     /**
      * This function subdivides the current node into 4 child nodes
      * and reassigns the particles to the appropriate child node.
@@ -111,55 +250,80 @@ void QuadNode::subdivide() {
      * Create the rect regions for the four children.
      * Each child node is initialized with a new rect.
      */
-    children[0] = std::make_unique<QuadNode>(
-            Rect(Point2D(xmin, ymin), Point2D(xmid, ymid)), this);
-    children[1] = std::make_unique<QuadNode>(
-            Rect(Point2D(xmid, ymin), Point2D(xmax, ymid)), this);
-    children[2] = std::make_unique<QuadNode>(
-            Rect(Point2D(xmin, ymid), Point2D(xmid, ymax)), this);
-    children[3] = std::make_unique<QuadNode>(
-            Rect(Point2D(xmid, ymid), Point2D(xmax, ymax)), this);
+    firstChild = pool->allocateGroup();
+    pool->at(firstChild).init(Rect(Point2D(xmin, ymin), Point2D(xmid, ymid)),
+                              firstChild, self, pool, owners);
+    pool->at(firstChild + 1).init(Rect(Point2D(xmid, ymin), Point2D(xmax, ymid)),
+                                  firstChild + 1, self, pool, owners);
+    pool->at(firstChild + 2).init(Rect(Point2D(xmin, ymid), Point2D(xmid, ymax)),
+                                  firstChild + 2, self, pool, owners);
+    pool->at(firstChild + 3).init(Rect(Point2D(xmid, ymid), Point2D(xmax, ymax)),
+                                  firstChild + 3, self, pool, owners);
 
     /**
      * Reassign particles to the appropriate child node.
      * After reassigning, clear the particle list in the current node.
      */
-    for (const auto &particle: particles) {
-        relocateParticle(particle);
+    for (Index particle: particles) {
+        relocateParticle(particle, system);
     }
 
     // Clear particles from the current node after reassignment
     particles.clear();
 }
 
-void QuadNode::relocateParticle(const std::shared_ptr<Particle> &particle) {
+void QuadNode::relocateParticle(Index particle,
+                                const ParticleSystem &system,
+                                const QuadNode *top,
+                                std::vector<Index> *migrants) {
     /**
      * If a particle has moved, this function should find its new location
      * and move it to the correct node.
      * It first removes the particle from the current node,
      * and then attempts to insert it into the appropriate node by scaling up the tree.
      * Then, it propagates the particle to the correct node.
+     * The climb stops at top: a particle outside top is left to the caller.
      */
 
     auto current = this;
-    while (!current->boundary.contains(particle->getPosition()))
-        current = current->parent;
-    current->propagate(particle);
+    Point2D position = system.getPosition(particle);
+    while (!current->boundary.contains(position)) {
+        if (current == top) {
+            migrants->push_back(particle);
+            return;
+        }
+        current = current->parentNode();
+    }
+    current->propagate(particle, system);
 }
 
-void QuadNode::removeEmptyNode(QuadNode *emptyChild) {
+uint32_t QuadNodePool::allocateGroup() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!freeGroups.empty()) {
+        uint32_t first = freeGroups.back();
+        freeGroups.pop_back();
+        return first;
+    }
+    if (uint64_t(used) + 4 > MAX_NODES) {
+        throw std::length_error("QuadNodePool is out of node indices");
+    }
+
     /**
-     * This function removes an empty child node from the current node.
-     * It is called after a particle has been relocated to another node.
-     * The empty child node is removed from the children array.
+     * Blocks hold 64, 128, 256, ... nodes; their sizes and starts are
+     * multiples of four, so a group never straddles two blocks.
      */
-
-    // Find the empty child node in the children array
-    for (auto &i: children) {
-        if (i.get() == emptyChild) {
-            // Remove the empty child node
-            i.reset();
-            return;
-        }
+    uint32_t first = used;
+    uint64_t slot = uint64_t(first) + (uint64_t(1) << FIRST_BLOCK_BITS);
+    unsigned block = std::bit_width(slot) - 1 - FIRST_BLOCK_BITS;
+    if (!blocks[block]) {
+        blocks[block] = std::make_unique<QuadNode[]>(
+                size_t(1) << (block + FIRST_BLOCK_BITS));
     }
-}
\ No newline at end of file
+    used += 4;
+    return first;
+}
+
+void QuadNodePool::freeGroup(uint32_t first) {
+    std::lock_guard<std::mutex> guard(lock);
+    freeGroups.push_back(first);
+}
@@ -4,80 +4,368 @@
 #include <set>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <stdexcept>
 #include "quadtree.h"
+#include "parallel.h"
 
 size_t QuadTree::bucketSize = 6;
 
 
-void
-QuadTree::insert(const std::vector<std::shared_ptr<Particle>> &particles) {
-    for (const auto &particle: particles) {
-        root->insert(particle);
+void QuadTree::makeRoot(const Rect &boundary) {
+    pool = std::make_unique<QuadNodePool>();
+    uint32_t index = pool->allocateGroup(); // The root's group mates stay unused
+    root = &pool->at(index);
+    root->init(boundary, index, QuadNode::NONE, pool.get(), nullptr);
+}
+
+
+void QuadTree::insert(const ParticleSystem &particles) {
+    if (system && system != &particles) {
+        throw std::invalid_argument("QuadTree already indexes another system");
+    }
+    system = &particles;
+    if (!owners) {
+        owners = std::make_unique<std::vector<LeafCell>>();
+        root->setOwnerTable(owners.get());
+    }
+    owners->resize(particles.size());
+    for (ParticleSystem::Index i = indexed; i < particles.size(); ++i) {
+        root->insert(i, particles);
     }
+    indexed = particles.size();
 }
 
 
-std::vector<std::shared_ptr<Particle>>
+// Bounds of a node as plain doubles
+static std::array<double, 4> boundsOf(const QuadNode *node) {
+    const Rect &rect = node->getBoundary();
+    return {static_cast<double>(rect.getPmin().getX().getValue()),
+            static_cast<double>(rect.getPmin().getY().getValue()),
+            static_cast<double>(rect.getPmax().getX().getValue()),
+            static_cast<double>(rect.getPmax().getY().getValue())};
+}
+
+std::vector<ParticleSystem::Index>
 QuadTree::knn(const Point2D &queryPoint, size_t k) {
-    using PQElement = std::pair<NType, std::shared_ptr<Particle>>;
-    auto compareParticles = [](const PQElement &a, const PQElement &b) {
-        return a.first <
-               b.first;
-    };
-    std::priority_queue<PQElement, std::vector<PQElement>, decltype(compareParticles)> pq(
-            compareParticles);
-
-    // Priority queue for best-first search of nodes
-    using SearchNode = std::pair<NType, QuadNode *>;
-    auto compareNodes = [](const SearchNode &a, const SearchNode &b) {
-        return a.first > b.first;  // Min heap, closer nodes should come first
-    };
-    std::priority_queue<SearchNode, std::vector<SearchNode>, decltype(compareNodes)> searchQueue(
-            compareNodes);
+    static thread_local QuadKnnContext context;
+
+    std::vector<ParticleSystem::Index> result;
+    knn(queryPoint, k, context, result);
+    return result;
+}
+
+
+void QuadTree::knn(const Point2D &queryPoint, size_t k,
+                   QuadKnnContext &context,
+                   std::vector<ParticleSystem::Index> &result) const {
+    /**
+     * Best-first search whose candidate heap and node queue live in the
+     * context. Candidates are particle indices, read from the system.
+     * Distances are squared doubles, so no comparison takes a square root.
+     * A child is only queued if it could still hold one of the k nearest,
+     * and the search stops as soon as the closest pending node is farther
+     * than the current k-th neighbor: every node left is farther still.
+     */
+    context.reset(k);
+    if (!root || !system || k == 0) {
+        result.clear();
+        return;
+    }
+    const double qx = static_cast<double>(queryPoint.getX().getValue());
+    const double qy = static_cast<double>(queryPoint.getY().getValue());
+    const double *x = system->positionsX().data();
+    const double *y = system->positionsY().data();
 
     // Start the search with the root node
-    searchQueue.emplace(0.0, root.get());
-    while (!searchQueue.empty()) {
+    context.pushClosest(0.0, root);
+    while (context.hasPending()) {
         // Get the node with the smallest distance
-        auto [nodeDist, currentNode] = searchQueue.top();
-        searchQueue.pop();
-
-        if (!currentNode) continue;  // Skip null nodes
+        auto [bound, currentNode] = context.popClosest();
+        if (context.full() && bound > context.worst()) {
+            break;
+        }
 
         if (currentNode->isLeaf()) {
-            for (const auto &particle: currentNode->getParticles()) {
-                NType dist = queryPoint.distance(particle->getPosition());
-                if (pq.size() < k) {
-                    pq.emplace(dist, particle);
-                } else if (dist < pq.top().first) {
-                    pq.pop();
-                    pq.emplace(dist, particle);
+            for (ParticleSystem::Index particle: currentNode->getParticles()) {
+                double dx = x[particle] - qx;
+                double dy = y[particle] - qy;
+                context.offer(dx * dx + dy * dy, particle);
+            }
+        } else {
+            for (QuadNode *child: currentNode->getChildren()) {
+                auto [xmin, ymin, xmax, ymax] = boundsOf(child);
+                double dx = std::max({xmin - qx, 0.0, qx - xmax});
+                double dy = std::max({ymin - qy, 0.0, qy - ymax});
+                double childBound = dx * dx + dy * dy;
+                if (!context.full() || childBound <= context.worst()) {
+                    context.pushClosest(childBound, child);
                 }
             }
+        }
+    }
+
+    context.drain(result);
+}
+
+void QuadTree::queryRect(const Rect &range,
+                         std::vector<ParticleSystem::Index> &result) const {
+    result.clear();
+    queryRect(range, [&result](ParticleSystem::Index particle) {
+        result.push_back(particle);
+    });
+}
+
+void QuadTree::queryRadius(const Point2D &center, double radius,
+                           std::vector<ParticleSystem::Index> &result) const {
+    result.clear();
+    queryRadius(center, radius, [&result](ParticleSystem::Index particle) {
+        result.push_back(particle);
+    });
+}
+
+void QuadTree::collisionPairs(double radius, std::vector<ParticlePair> &pairs,
+                              size_t numThreads) const {
+    /**
+     * Broad phase over the leaves. Each leaf searches the tree, from its
+     * lowest ancestor that covers it grown by radius, for the leaves whose
+     * Rect lies within radius of its own, and tests its
+     * particles against theirs; a pair of leaves is handled only by the
+     * one with the smaller pool index, so no pair is reported twice.
+     * Leaves are claimed in chunks from a shared counter and every thread
+     * writes to its own buffer, concatenated at the end. For a bounded
+     * density each leaf has a bounded number of neighbors, so the cost
+     * stays close to linear in the number of particles.
+     */
+    pairs.clear();
+    if (!root || !system || radius < 0) {
+        return;
+    }
+
+    std::vector<const QuadNode *> leaves;
+    std::vector<const QuadNode *> pending{root};
+    while (!pending.empty()) {
+        const QuadNode *node = pending.back();
+        pending.pop_back();
+        if (node->isLeaf()) {
+            if (!node->getParticles().empty()) {
+                leaves.push_back(node);
+            }
         } else {
-            for (const auto &child: currentNode->getChildren()) {
-                if (child) {
-                    NType childDist = minDistToRect(queryPoint,
-                                                    child->getBoundary());
-                    searchQueue.emplace(childDist, child.get());
+            for (const QuadNode *child: node->getChildren()) {
+                pending.push_back(child);
+            }
+        }
+    }
+
+    constexpr size_t LEAVES_PER_CLAIM = 64;
+    numThreads = std::min(resolveThreads(numThreads),
+                          std::max<size_t>(leaves.size() / LEAVES_PER_CLAIM, 1));
+    std::vector<std::vector<ParticlePair>> buffers(numThreads);
+    std::atomic<size_t> nextLeaf{0};
+    const double radiusSquared = radius * radius;
+    const double *x = system->positionsX().data();
+    const double *y = system->positionsY().data();
+
+    parallelFor(0, numThreads, numThreads,
+                [&, x, y](size_t thread, size_t, size_t) {
+        std::vector<ParticlePair> &found = buffers[thread];
+        std::vector<const QuadNode *> stack;
+
+        auto testPairs = [&](const QuadNode *a, const QuadNode *b) {
+            const auto &first = a->getParticles();
+            const auto &second = b->getParticles();
+            for (size_t i = 0; i < first.size(); ++i) {
+                ParticleSystem::Index p = first[i];
+                size_t start = a == b ? i + 1 : 0;
+                for (size_t j = start; j < second.size(); ++j) {
+                    ParticleSystem::Index q = second[j];
+                    double dx = x[p] - x[q];
+                    double dy = y[p] - y[q];
+                    if (dx * dx + dy * dy <= radiusSquared) {
+                        found.emplace_back(std::min(p, q), std::max(p, q));
+                    }
+                }
+            }
+        };
+
+        for (size_t begin = nextLeaf.fetch_add(LEAVES_PER_CLAIM);
+             begin < leaves.size();
+             begin = nextLeaf.fetch_add(LEAVES_PER_CLAIM)) {
+            size_t end = std::min(leaves.size(), begin + LEAVES_PER_CLAIM);
+            for (size_t l = begin; l < end; ++l) {
+                const QuadNode *leaf = leaves[l];
+                auto [xmin, ymin, xmax, ymax] = boundsOf(leaf);
+                testPairs(leaf, leaf);
+
+                // Search from the lowest ancestor covering the leaf grown by radius
+                const QuadNode *top = leaf;
+                while (top->getParent()) {
+                    auto [txmin, tymin, txmax, tymax] = boundsOf(top);
+                    if (txmin <= xmin - radius && tymin <= ymin - radius &&
+                        txmax >= xmax + radius && tymax >= ymax + radius) {
+                        break;
+                    }
+                    top = top->getParent();
+                }
+                stack.assign(1, top);
+                while (!stack.empty()) {
+                    const QuadNode *node = stack.back();
+                    stack.pop_back();
+                    auto [nxmin, nymin, nxmax, nymax] = boundsOf(node);
+                    double dx = std::max({nxmin - xmax, 0.0, xmin - nxmax});
+                    double dy = std::max({nymin - ymax, 0.0, ymin - nymax});
+                    if (dx * dx + dy * dy > radiusSquared) {
+                        continue;
+                    }
+                    if (!node->isLeaf()) {
+                        for (const QuadNode *child: node->getChildren()) {
+                            stack.push_back(child);
+                        }
+                    } else if (node->getIndex() > leaf->getIndex()) {
+                        testPairs(leaf, node);
+                    }
                 }
             }
         }
+    });
+
+    size_t total = 0;
+    for (auto &found: buffers) {
+        total += found.size();
     }
+    pairs.reserve(total);
+    for (auto &found: buffers) {
+        pairs.insert(pairs.end(), found.begin(), found.end());
+    }
+}
 
+void QuadTree::updateTree(size_t numThreads) {
+    /**
+     * The top of the tree is cut into disjoint subtrees, several per
+     * thread, and the threads claim them from a shared counter until none
+     * is left, so a crowded subtree does not hold the others back. Each
+     * subtree is updated in place; particles that cross its border are
+     * collected in the thread's migration queue and reinserted from the
+     * root once every thread is done. Underfull subtrees are then merged,
+     * each thread within its own subtrees and the levels above serially.
+     */
+    if (!system) {
+        return;
+    }
+    numThreads = resolveThreads(numThreads);
+    if (numThreads == 1 || root->isLeaf()) {
+        root->updateNode(*system);
+        root->collapse(collapseThreshold());
+        return;
+    }
 
-    std::vector<std::shared_ptr<Particle>> result;
-    while (!pq.empty()) {
-        result.push_back(pq.top().second);
-        pq.pop();
+    const size_t targetSubtrees = 4 * numThreads;
+    std::vector<QuadNode *> subtrees{root};
+    size_t expandedLevels = 0;
+    bool expanded = true;
+    while (expanded && subtrees.size() < targetSubtrees) {
+        expanded = false;
+        std::vector<QuadNode *> next;
+        for (QuadNode *node: subtrees) {
+            if (node->isLeaf()) {
+                next.push_back(node);
+                continue;
+            }
+            for (QuadNode *child: node->getChildren()) {
+                next.push_back(child);
+            }
+            expanded = true;
+        }
+        expandedLevels += expanded;
+        subtrees.swap(next);
     }
 
-    std::reverse(result.begin(), result.end());
+    migrationQueues.resize(numThreads);
+    std::atomic<size_t> nextSubtree{0};
+    parallelFor(0, numThreads, numThreads,
+                [this, &subtrees, &nextSubtree](size_t thread, size_t,
+                                                size_t) {
+        std::vector<ParticleSystem::Index> &migrants = migrationQueues[thread];
+        migrants.clear();
+        for (size_t i = nextSubtree++; i < subtrees.size();
+             i = nextSubtree++) {
+            subtrees[i]->updateNode(*system, migrants);
+            subtrees[i]->collapse(collapseThreshold());
+        }
+    });
 
-    return result;
+    // Merge phase
+    for (auto &migrants: migrationQueues) {
+        for (ParticleSystem::Index particle: migrants) {
+            root->insert(particle, *system);
+        }
+    }
+    if (expandedLevels > 0) {
+        root->collapse(collapseThreshold(), expandedLevels - 1);
+    }
 }
 
-void QuadTree::updateTree() {
-    std::set<std::shared_ptr<Particle>> particlesToRelocate;
-    root->updateNode();
+void QuadTree::updateMoved(size_t numThreads) {
+    /**
+     * Every particle is checked against the leaf cell recorded for it, a
+     * streaming pass over flat arrays that touches no node. Only the
+     * particles found outside their leaf are then relocated, grouped by
+     * leaf so that neighbouring relocations share cached nodes. The tree
+     * work of a frame grows with the movement, not with the particle count.
+     * When most particles moved, the leaf-order walk of updateTree is
+     * faster than relocating them one by one, so that is used instead.
+     */
+    if (!system) {
+        return;
+    }
+    constexpr size_t MIN_PARTICLES_PER_THREAD = 1 << 15;
+    size_t useful = std::max<size_t>(system->size() / MIN_PARTICLES_PER_THREAD,
+                                     1);
+    numThreads = std::min(resolveThreads(numThreads), useful);
+
+    migrationQueues.resize(numThreads);
+    const LeafCell *cells = owners->data();
+    const double *x = system->positionsX().data();
+    const double *y = system->positionsY().data();
+    parallelFor(0, system->size(), numThreads,
+                [this, cells, x, y](size_t thread, size_t from, size_t to) {
+        std::vector<ParticleSystem::Index> &moved = migrationQueues[thread];
+        moved.clear();
+        for (size_t i = from; i < to; ++i) {
+            if (cells[i].leaf && !cells[i].contains(x[i], y[i])) {
+                moved.push_back(static_cast<ParticleSystem::Index>(i));
+            }
+        }
+    });
+
+    size_t totalMoved = 0;
+    for (auto &moved: migrationQueues) {
+        totalMoved += moved.size();
+    }
+    if (totalMoved > system->size() / 4) {
+        updateTree(numThreads);
+        return;
+    }
+
+    std::vector<std::pair<QuadNode *, ParticleSystem::Index>> batch;
+    batch.reserve(totalMoved);
+    for (auto &moved: migrationQueues) {
+        for (ParticleSystem::Index particle: moved) {
+            batch.emplace_back((*owners)[particle].leaf, particle);
+        }
+    }
+    std::sort(batch.begin(), batch.end());
+    for (auto &[leaf, particle]: batch) {
+        (*owners)[particle].leaf->relocate(particle, *system);
+    }
+
+    // Only the leaves that lost particles can have left a subtree underfull
+    std::vector<QuadNode *> sources;
+    for (auto &[leaf, particle]: batch) {
+        if (sources.empty() || sources.back() != leaf) {
+            sources.push_back(leaf);
+        }
+    }
+    QuadNode::collapseParents(sources, collapseThreshold());
 }
@@ -0,0 +1,129 @@
+#include "querycache.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+KnnQueryCache::KnnQueryCache(SSTree &tree, size_t capacity, float quantum)
+        : tree(tree), capacity(capacity), quantum(quantum) {
+  if (capacity == 0) {
+    throw std::invalid_argument("KnnQueryCache needs room for one entry");
+  }
+  if (!(quantum > 0.0f)) {
+    throw std::invalid_argument("Quantization step must be positive");
+  }
+}
+
+/**
+ * hashQuery
+ * Hashes the query snapped to the quantization grid, together with k.
+ * Cells are clamped to the int64_t range, and NaN coordinates share cell 0,
+ * so rounding is always defined.
+ * @return uint64_t: Bucket key.
+ */
+uint64_t KnnQueryCache::hashQuery(const Point &query, size_t k) const {
+  constexpr double maxCell = 9.0e18; // Below INT64_MAX, exact in a double
+  uint64_t h = 0xcbf29ce484222325ULL ^ k;
+  const float *coordinates = query.data();
+  for (size_t i = 0; i < DIM; ++i) {
+    double scaled = static_cast<double>(coordinates[i]) / quantum;
+    scaled = std::isnan(scaled) ? 0.0 : std::clamp(scaled, -maxCell, maxCell);
+    auto cell = static_cast<int64_t>(std::llround(scaled));
+    h ^= static_cast<uint64_t>(cell) + 0x9e3779b97f4a7c15ULL + (h << 6) +
+         (h >> 2);
+  }
+  return h;
+}
+
+size_t KnnQueryCache::entryBytes(const Entry &entry) {
+  return sizeof(Entry) + DIM * sizeof(float) +
+         entry.result.capacity() * sizeof(Data *) +
+         sizeof(std::list<Entry>::iterator) +
+         2 * sizeof(void *); // List links
+}
+
+/**
+ * evict
+ * Unlinks an entry from its bucket and drops it from the LRU list.
+ * @param entry: Entry to drop.
+ */
+void KnnQueryCache::evict(std::list<Entry>::iterator entry) {
+  auto bucket = index.find(entry->key);
+  std::erase(bucket->second, entry);
+  if (bucket->second.empty()) {
+    index.erase(bucket);
+  }
+  stats.memoryBytes -= entryBytes(*entry);
+  lru.erase(entry);
+}
+
+/**
+ * knn
+ * Returns the cached result when the same query and k were answered since
+ * the last tree update; otherwise runs the query on the tree and caches it.
+ * @param query: Query point.
+ * @param k: Number of neighbors.
+ * @return std::vector<Data *>: Neighbors sorted from closest to farthest.
+ */
+std::vector<Data *> KnnQueryCache::knn(const Point &query, size_t k) {
+  uint64_t key = hashQuery(query, k);
+  uint64_t version = tree.getVersion();
+  auto find = [&]() -> std::list<Entry>::iterator {
+      auto bucket = index.find(key);
+      if (bucket == index.end()) {
+        return lru.end();
+      }
+      for (auto entry: bucket->second) {
+        if (entry->k == k && std::memcmp(entry->query.data(), query.data(),
+                                         DIM * sizeof(float)) == 0) {
+          return entry;
+        }
+      }
+      return lru.end();
+  };
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    auto entry = find();
+    if (entry != lru.end()) {
+      if (entry->version == version) {
+        stats.hits++;
+        lru.splice(lru.begin(), lru, entry);
+        return entry->result;
+      }
+      stats.stale++;
+    }
+    stats.misses++;
+  }
+
+  static thread_local SSKnnContext context;
+  std::vector<Data *> result;
+  tree.knn(query, k, context, result);
+
+  std::lock_guard<std::mutex> guard(lock);
+  auto stale = find();
+  if (stale != lru.end()) {
+    evict(stale);
+  }
+  lru.push_front({key, query, k, version, result});
+  index[key].push_back(lru.begin());
+  stats.memoryBytes += entryBytes(lru.front());
+
+  while (lru.size() > capacity) {
+    evict(std::prev(lru.end()));
+  }
+  stats.entries = lru.size();
+  return result;
+}
+
+void KnnQueryCache::clear() {
+  std::lock_guard<std::mutex> guard(lock);
+  lru.clear();
+  index.clear();
+  stats.entries = 0;
+  stats.memoryBytes = 0;
+}
+
+QueryCacheStats KnnQueryCache::getStats() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return stats;
+}
@@ -30,6 +30,12 @@ bool Rect::intersects(const Rect &rect) const {
            pmin.getY() < rect.pmax.getY() && pmax.getY() > rect.pmin.getY();
 }
 
+bool Rect::touches(const Rect &rect) const {
+    return pmin.getX() <= rect.pmax.getX() &&
+           pmax.getX() >= rect.pmin.getX() &&
+           pmin.getY() <= rect.pmax.getY() && pmax.getY() >= rect.pmin.getY();
+}
+
 bool Rect::isWithin(const Rect &rect) const {
     return pmin.getX() >= rect.pmin.getX() &&
            pmax.getX() <= rect.pmax.getX() &&
@@ -0,0 +1,209 @@
+#include "shardedsstree.h"
+#include <limits>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+ShardedSSTree::ShardedSSTree(size_t numShards, size_t maxPointsPerNode,
+                             ShardPolicy policy) : policy(policy) {
+  if (numShards == 0) {
+    throw std::invalid_argument("ShardedSSTree needs at least one shard");
+  }
+
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t i = 0; i < numShards; ++i) {
+    shards.push_back(std::make_unique<Shard>(SSTree(maxPointsPerNode)));
+    Shard &shard = *shards.back();
+    shard.worker = std::thread(run, std::ref(shard));
+
+#ifdef __linux__
+    // Pin each worker to its own core so a shard stays in one cache
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(i % cores, &cpus);
+    pthread_setaffinity_np(shard.worker.native_handle(), sizeof(cpus), &cpus);
+#endif
+  }
+}
+
+ShardedSSTree::~ShardedSSTree() {
+  for (auto &shard: shards) {
+    {
+      std::lock_guard<std::mutex> guard(shard->lock);
+      shard->stopping = true;
+    }
+    shard->ready.notify_one();
+  }
+  for (auto &shard: shards) {
+    shard->worker.join();
+  }
+}
+
+/**
+ * run
+ * Worker loop: executes the shard's tasks in order until stopped and the
+ * queue is drained.
+ * @param shard: Shard owned by this worker.
+ */
+void ShardedSSTree::run(Shard &shard) {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> guard(shard.lock);
+      shard.ready.wait(guard, [&shard]() {
+          return shard.stopping || !shard.tasks.empty();
+      });
+      if (shard.tasks.empty()) {
+        return;
+      }
+      task = std::move(shard.tasks.front());
+      shard.tasks.pop_front();
+    }
+    task();
+  }
+}
+
+void ShardedSSTree::enqueue(size_t shard, std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> guard(shards[shard]->lock);
+    shards[shard]->tasks.push_back(std::move(task));
+  }
+  shards[shard]->ready.notify_one();
+}
+
+void ShardedSSTree::setRoutingCentroids(const std::vector<Point> &centroids) {
+  if (centroids.size() != shards.size()) {
+    throw std::invalid_argument("Expected one routing centroid per shard");
+  }
+  routingCentroids = centroids;
+}
+
+/**
+ * shardFor
+ * Chooses the shard that owns an entry.
+ * @param _data: Entry to route.
+ * @return size_t: Index of the owning shard.
+ */
+size_t ShardedSSTree::shardFor(const Data *_data) const {
+  if (policy == CLUSTER_SHARDING) {
+    if (routingCentroids.empty()) {
+      throw std::logic_error("CLUSTER_SHARDING needs routing centroids");
+    }
+    size_t best = 0;
+    float bestDistance = std::numeric_limits<float>::max();
+    for (size_t i = 0; i < routingCentroids.size(); ++i) {
+      float dist = _data->getEmbedding().distanceSquaredBounded(
+              routingCentroids[i], bestDistance);
+      if (dist < bestDistance) {
+        bestDistance = dist;
+        best = i;
+      }
+    }
+    return best;
+  }
+  return std::hash<std::string>()(_data->getPath()) % shards.size();
+}
+
+/**
+ * insert
+ * Queues an insert on the owning shard. Returns without waiting for it.
+ * @param _data: Data to be inserted.
+ */
+void ShardedSSTree::insert(Data *_data) {
+  size_t target = shardFor(_data);
+  Shard &shard = *shards[target];
+  enqueue(target, [&shard, _data]() {
+      if (shard.tree.insert(_data)) {
+        shard.size++;
+      }
+  });
+}
+
+/**
+ * insert
+ * Routes a batch and queues one task per shard, so each worker gets its
+ * whole share in a single wake-up.
+ * @param data: Entries to insert.
+ */
+void ShardedSSTree::insert(const std::vector<Data *> &data) {
+  std::vector<std::vector<Data *>> batches(shards.size());
+  for (Data *d: data) {
+    batches[shardFor(d)].push_back(d);
+  }
+  for (size_t i = 0; i < shards.size(); ++i) {
+    if (batches[i].empty()) {
+      continue;
+    }
+    Shard &shard = *shards[i];
+    enqueue(i, [&shard, batch = std::move(batches[i])]() {
+        size_t added = 0;
+        for (Data *d: batch) {
+          added += shard.tree.insert(d);
+        }
+        shard.size += added;
+    });
+  }
+}
+
+void ShardedSSTree::flush() {
+  std::vector<std::future<void>> done;
+  for (size_t i = 0; i < shards.size(); ++i) {
+    auto barrier = std::make_shared<std::promise<void>>();
+    done.push_back(barrier->get_future());
+    enqueue(i, [barrier]() { barrier->set_value(); });
+  }
+  for (auto &f: done) {
+    f.wait();
+  }
+}
+
+size_t ShardedSSTree::size() const {
+  size_t total = 0;
+  for (const auto &shard: shards) {
+    total += shard->size.load();
+  }
+  return total;
+}
+
+/**
+ * knn
+ * Scatter-gather kNN: every shard answers the query on its own worker, and
+ * the per-shard results, with the distances the shard search computed, are
+ * merged into the global top-k. An error in a shard is rethrown here.
+ * @param query: Query point.
+ * @param k: Number of neighbors.
+ * @return std::vector<Data *>: Neighbors sorted from closest to farthest.
+ */
+std::vector<Data *> ShardedSSTree::knn(Point &query, size_t k) {
+  using Partial = std::vector<SSKnnContext::Entry>;
+
+  std::vector<std::future<Partial>> partials;
+  for (size_t i = 0; i < shards.size(); ++i) {
+    auto promise = std::make_shared<std::promise<Partial>>();
+    partials.push_back(promise->get_future());
+    Shard &shard = *shards[i];
+    enqueue(i, [&shard, &query, k, promise]() {
+        static thread_local SSKnnContext context;
+        try {
+          Partial partial;
+          shard.tree.knn(query, k, context, partial);
+          promise->set_value(std::move(partial));
+        } catch (...) {
+          promise->set_exception(std::current_exception());
+        }
+    });
+  }
+
+  KnnContext<float, Data *, Shard> merged(k);
+  for (auto &f: partials) {
+    for (const auto &[dist, d]: f.get()) {
+      merged.offer(dist, d);
+    }
+  }
+
+  std::vector<Data *> result;
+  merged.drain(result);
+  return result;
+}
@@ -1,4 +1,8 @@
 #include "sstree.h"
+#include "parallel.h"
+#include <atomic>
+#include <cmath>
+#include <numbers>
 
 /**
  * intersectsPoint
@@ -7,7 +11,7 @@
  * @return bool: Returns true if the point is within the sphere, false otherwise.
  */
 bool SSNode::intersectsPoint(const Point &point) const {
-  return (centroid - point).norm() <= radius;
+  return center.distance(point) <= radius;
 }
 
 /**
@@ -25,8 +29,9 @@ SSNode *SSNode::findClosestChild(const Point &target) {
   SSNode *closestChild = nullptr;
   float minDistance = std::numeric_limits<float>::max();
 
+  // Squared distances with early abandoning against the best child so far
   for (SSNode *child: children) {
-    float dist = (child->centroid - target).norm();
+    float dist = child->centroid.distanceSquaredBounded(target, minDistance);
     if (dist < minDistance) {
       minDistance = dist;
       closestChild = child;
@@ -46,30 +51,151 @@ SSNode::computeMeanForDimension(std::vector<Point> &centroids, size_t i) {
   return mean;
 }
 
+/**
+ * coveringRadius
+ * Computes the smallest radius of a sphere with the given center that covers
+ * every entry (data points in leaves, child spheres in internal nodes).
+ * @param sphereCenter: Center of the sphere.
+ * @return float: Covering radius.
+ */
+float SSNode::coveringRadius(const Point &sphereCenter) const {
+  float r = 0.f;
+  if (isLeaf) {
+    for (Data *d: _data) {
+      r = std::max(r, sphereCenter.distance(d->getEmbedding()));
+    }
+  } else {
+    for (SSNode *child: children) {
+      r = std::max(r, sphereCenter.distance(child->center) + child->radius);
+    }
+  }
+  return r;
+}
+
+/**
+ * minimumEnclosingCenter
+ * Approximates the center of the minimum enclosing ball of the entries with
+ * the Badoiu-Clarkson iteration: repeatedly step towards the farthest
+ * extent of the entries with a step of 1 / (i + 1).
+ * @return Point: Approximate center of the minimum enclosing ball.
+ */
+Point SSNode::minimumEnclosingCenter() const {
+  constexpr size_t ITERATIONS = 64;
+
+  Point c = centroid;
+  for (size_t i = 1; i <= ITERATIONS; ++i) {
+    Point farthest = c;
+    float maxExtent = -1.f;
+    if (isLeaf) {
+      for (Data *d: _data) {
+        float dist = c.distance(d->getEmbedding());
+        if (dist > maxExtent) {
+          maxExtent = dist;
+          farthest = d->getEmbedding();
+        }
+      }
+    } else {
+      for (SSNode *child: children) {
+        float dist = c.distance(child->center);
+        if (dist + child->radius > maxExtent) {
+          maxExtent = dist + child->radius;
+          // Point of the child sphere farthest from c
+          farthest = child->center;
+          if (dist > EPSILON) {
+            farthest += (child->center - c) * (child->radius / dist);
+          }
+        }
+      }
+    }
+    c += (farthest - c) * (1.f / static_cast<float>(i + 1));
+  }
+  return c;
+}
+
 /**
  * updateBoundingEnvelope
  * Updates the centroid and radius of the node based on internal nodes or data points.
+ * In MIN_ENCLOSING_SPHERE mode the sphere center is refitted with
+ * minimumEnclosingCenter only when refit is set (at split time); otherwise
+ * the current center or the centroid is kept, whichever gives the smaller
+ * sphere, so the sphere is never looser than the centroid one.
+ * @param refit: Recomputes the approximate minimum enclosing ball.
  */
-void SSNode::updateBoundingEnvelope() {
+void SSNode::updateBoundingEnvelope(bool refit) {
+  updateSummary();
+
   std::vector<Point> points = getEntriesCentroids();
   for (size_t i = 0; i < DIM; i++)
     this->centroid[i] = computeMeanForDimension(points, i);
 
-  this->radius = 0.f;
+  if (sphereMode == CENTROID_SPHERE) {
+    center = centroid;
+    radius = coveringRadius(center);
+    return;
+  }
+
+  if (refit) {
+    center = minimumEnclosingCenter();
+  }
+  float fittedRadius = coveringRadius(center);
+  float centroidRadius = coveringRadius(centroid);
+  if (centroidRadius < fittedRadius) {
+    center = centroid;
+    radius = centroidRadius;
+  } else {
+    radius = fittedRadius;
+  }
+}
+
+/**
+ * updateSummary
+ * Recomputes the category bitmap and timestamp range of the subtree from
+ * the entries (leaves) or the children summaries (internal nodes).
+ */
+void SSNode::updateSummary() {
+  categoryMask = 0;
+  minTimestamp = std::numeric_limits<int64_t>::max();
+  maxTimestamp = std::numeric_limits<int64_t>::min();
   if (isLeaf) {
-    for (auto &point: points) {
-      this->radius = std::max(this->radius, (point - centroid).norm());
+    for (const Data *d: _data) {
+      categoryMask |= categoryBit(d->getCategory());
+      minTimestamp = std::min(minTimestamp, d->getTimestamp());
+      maxTimestamp = std::max(maxTimestamp, d->getTimestamp());
     }
   } else {
-    for (auto &child: children) {
-      float dist = (child->centroid - centroid).norm() + child->radius;
-      if (dist > radius) {
-        radius = dist;
-      }
+    for (const SSNode *child: children) {
+      categoryMask |= child->categoryMask;
+      minTimestamp = std::min(minTimestamp, child->minTimestamp);
+      maxTimestamp = std::max(maxTimestamp, child->maxTimestamp);
     }
   }
 }
 
+bool KnnFilter::matches(const Data &entry) const {
+  if (entry.getTimestamp() < minTimestamp ||
+      entry.getTimestamp() > maxTimestamp) {
+    return false;
+  }
+  return categories.empty() ||
+         std::find(categories.begin(), categories.end(),
+                   entry.getCategory()) != categories.end();
+}
+
+bool KnnFilter::mayMatch(const SSNode &node) const {
+  if (node.getMaxTimestamp() < minTimestamp ||
+      node.getMinTimestamp() > maxTimestamp) {
+    return false;
+  }
+  if (categories.empty()) {
+    return true;
+  }
+  uint64_t mask = 0;
+  for (uint32_t category: categories) {
+    mask |= categoryBit(category);
+  }
+  return (node.getCategoryMask() & mask) != 0;
+}
+
 /**
  * directionOfMaxVariance
  * Computes and returns the index of the direction with the maximum variance.
@@ -80,7 +206,7 @@ size_t SSNode::directionOfMaxVariance() {
   size_t maxDirection = 0;
   float maxVariance = 0.0f;
 
-  for (size_t i = 0; i < centroids.size(); ++i) {
+  for (size_t i = 0; i < DIM; ++i) {
     float mean = 0.0f;
     for (const Point &p: centroids) {
       mean += p[i];
@@ -115,16 +241,20 @@ std::pair<SSNode *, SSNode *> SSNode::split() {
   SSNode *newNode2;
 
   if (isLeaf) {
-    newNode1 = new SSNode(centroid, radius, true, parent);
-    newNode2 = new SSNode(centroid, radius, true, parent);
+    newNode1 = new SSNode(centroid, radius, true, parent, maxPointsPerNode,
+                          sphereMode);
+    newNode2 = new SSNode(centroid, radius, true, parent, maxPointsPerNode,
+                          sphereMode);
 
     newNode1->_data = std::vector<Data *>(_data.begin(),
                                           _data.begin() + splitIndex);
     newNode2->_data = std::vector<Data *>(_data.begin() + splitIndex,
                                           _data.end());
   } else {
-    newNode1 = new SSNode(centroid, radius, false, parent);
-    newNode2 = new SSNode(centroid, radius, false, parent);
+    newNode1 = new SSNode(centroid, radius, false, parent, maxPointsPerNode,
+                          sphereMode);
+    newNode2 = new SSNode(centroid, radius, false, parent, maxPointsPerNode,
+                          sphereMode);
 
     newNode1->children = std::vector<SSNode *>(children.begin(),
                                                children.begin() + splitIndex);
@@ -139,8 +269,8 @@ std::pair<SSNode *, SSNode *> SSNode::split() {
     }
   }
 
-  newNode1->updateBoundingEnvelope();
-  newNode2->updateBoundingEnvelope();
+  newNode1->updateBoundingEnvelope(true);
+  newNode2->updateBoundingEnvelope(true);
 
   return {newNode1, newNode2};
 }
@@ -153,12 +283,18 @@ std::pair<SSNode *, SSNode *> SSNode::split() {
  * @return size_t: The split index.
  */
 size_t SSNode::findSplitIndex(size_t coordinateIndex) {
-  std::sort(_data.begin(), _data.end(), [&](Data *a, Data *b) {
-      return a->getEmbedding()[coordinateIndex] <
-             b->getEmbedding()[coordinateIndex];
-  });
+  if (isLeaf) {
+    std::sort(_data.begin(), _data.end(), [&](Data *a, Data *b) {
+        return a->getEmbedding()[coordinateIndex] <
+               b->getEmbedding()[coordinateIndex];
+    });
+    return _data.size() / 2;
+  }
 
-  return _data.size() / 2;
+  std::sort(children.begin(), children.end(), [&](SSNode *a, SSNode *b) {
+      return a->centroid[coordinateIndex] < b->centroid[coordinateIndex];
+  });
+  return children.size() / 2;
 }
 
 /**
@@ -232,26 +368,59 @@ SSNode *SSNode::searchParentLeaf(SSNode *node, const Point &target) {
 /**
  * insert
  * Inserts data into the node, splitting if necessary.
+ * When evicted is given, a non-root leaf that overflows first gives up its
+ * reinsertFraction entries farthest from the centroid (R*-tree forced
+ * reinsertion) instead of splitting; the caller reinserts them from the root.
  * @param node: Node to insert data into.
  * @param _data: Data to be inserted.
+ * @param evicted: Output for entries to reinsert, or nullptr to always split.
+ * @param reinsertFraction: Fraction of the leaf to evict on overflow.
+ * @param added: Optional output, false if the leaf already held the data.
  * @return SSNode*: New root node if a split occurred, otherwise nullptr.
  */
-std::pair<SSNode *, SSNode *> SSNode::insert(SSNode *node, Data *_data) {
+std::pair<SSNode *, SSNode *> SSNode::insert(SSNode *node, Data *_data,
+                                             std::vector<Data *> *evicted,
+                                             float reinsertFraction,
+                                             bool *added) {
   if (node->isLeaf) {
     if (std::find(node->_data.begin(), node->_data.end(), _data) !=
         node->_data.end()) {
+      if (added) {
+        *added = false;
+      }
       return {nullptr, nullptr};
     }
 
+    if (added) {
+      *added = true;
+    }
     node->_data.push_back(_data);
     node->updateBoundingEnvelope();
     if (node->_data.size() <= maxPointsPerNode) {
       return {nullptr, nullptr};
     }
+
+    auto count = static_cast<size_t>(reinsertFraction *
+                                     static_cast<float>(node->_data.size()));
+    // A root leaf splits: reinserting would land in the same leaf
+    if (evicted && count > 0 && node->parent) {
+      const Point &mean = node->centroid;
+      std::sort(node->_data.begin(), node->_data.end(),
+                [&mean](Data *a, Data *b) {
+                    return a->getEmbedding().distanceSquared(mean) <
+                           b->getEmbedding().distanceSquared(mean);
+                });
+      evicted->insert(evicted->end(), node->_data.end() - count,
+                      node->_data.end());
+      node->_data.resize(node->_data.size() - count);
+      node->updateBoundingEnvelope();
+      return {nullptr, nullptr};
+    }
     return node->split();
   }
   SSNode *closestChild = node->findClosestChild(_data->getEmbedding());
-  auto [newRoot1, newRoot2] = insert(closestChild, _data);
+  auto [newRoot1, newRoot2] = insert(closestChild, _data, evicted,
+                                     reinsertFraction, added);
   if (newRoot1 == nullptr) {
     node->updateBoundingEnvelope();
     return {nullptr, nullptr};
@@ -293,19 +462,76 @@ SSNode *SSNode::search(SSNode *node, Data *_data) {
 /**
  * insert
  * Inserts data into the tree.
+ * With a reinsert fraction set, the first leaf overflow of the insertion
+ * evicts the leaf's farthest entries and reinserts them from the root; the
+ * reinsertions themselves split on overflow, as in the R*-tree.
  * @param _data: Data to be inserted.
+ * @return bool: False if the entry was already in the tree.
  */
-void SSTree::insert(Data *_data) {
+bool SSTree::insert(Data *_data) {
+  version++;
   if (root == nullptr) {
-    root = new SSNode(_data->getEmbedding(), 0.0f, true, nullptr);
+    root = new SSNode(_data->getEmbedding(), 0.0f, true, nullptr,
+                      maxPointsPerNode, sphereMode);
   }
-  auto [newRoot1, newRoot2] = root->insert(root, _data);
-  if (newRoot1 != nullptr) {
-    root = new SSNode(_data->getEmbedding(), 0.0f, false, nullptr);
-    root->children.push_back(newRoot1);
-    root->children.push_back(newRoot2);
-    root->isLeaf = false;
+
+  std::vector<Data *> evicted;
+  std::vector<Data *> *overflow = reinsertFraction > 0.0f ? &evicted
+                                                          : nullptr;
+  bool added = false;
+  bool *report = &added; // Only the entry itself reports, not reinsertions
+  std::vector<Data *> pending = {_data};
+  while (!pending.empty()) {
+    Data *entry = pending.back();
+    pending.pop_back();
+
+    auto [newRoot1, newRoot2] = root->insert(root, entry, overflow,
+                                             reinsertFraction, report);
+    report = nullptr;
+    if (newRoot1 != nullptr) {
+      root = new SSNode(entry->getEmbedding(), 0.0f, false, nullptr,
+                        maxPointsPerNode, sphereMode);
+      root->children.push_back(newRoot1);
+      root->children.push_back(newRoot2);
+      newRoot1->setParent(root);
+      newRoot2->setParent(root);
+      root->updateBoundingEnvelope(true);
+    }
+
+    // Forced reinsertion happens at most once per insertion
+    if (!evicted.empty()) {
+      pending.insert(pending.end(), evicted.begin(), evicted.end());
+      evicted.clear();
+      overflow = nullptr;
+    }
   }
+  return added;
+}
+
+/**
+ * remove
+ * Removes an entry from the tree. An emptied root is released, and a root
+ * left with a single child is replaced by that child.
+ * @param _data: Data to be removed.
+ * @return bool: True if the entry was in the tree.
+ */
+bool SSTree::remove(Data *_data) {
+  if (root == nullptr || !root->remove(_data)) {
+    return false;
+  }
+  version++;
+
+  while (!root->isLeaf && root->children.size() == 1) {
+    SSNode *child = root->children.front();
+    delete root;
+    root = child;
+    root->setParent(nullptr);
+  }
+  if (root->isLeaf ? root->getData().empty() : root->children.empty()) {
+    delete root;
+    root = nullptr;
+  }
+  return true;
 }
 
 /**
@@ -318,50 +544,486 @@ SSNode *SSTree::search(Data *_data) {
   return root ? root->search(root, _data) : nullptr;
 }
 
-void SSNode::knn(SSNode *&node, Point &query, size_t k,
-                 std::priority_queue<std::pair<float, Data *>> &max_heap) {
-  if (max_heap.size() == k) {
-    float maxDistance = max_heap.top().first;
-    float distanceToNode = Point::distance(query, node->getCentroid());
+/**
+ * findLeaf
+ * Finds the leaf holding an entry, descending into every child whose sphere
+ * contains the entry (with a small tolerance for rounding in the radii).
+ * @param entry: Entry to look for.
+ * @return SSNode*: Leaf holding the entry (or nullptr if not found).
+ */
+SSNode *SSNode::findLeaf(const Data *entry) {
+  if (isLeaf) {
+    bool found = std::find(_data.begin(), _data.end(), entry) != _data.end();
+    return found ? this : nullptr;
+  }
 
-    if (maxDistance + node->getRadius() < distanceToNode) {
-      return;
+  for (SSNode *child: children) {
+    float tolerance = EPSILON + 1e-4f * child->radius;
+    if (child->center.distance(entry->getEmbedding()) <=
+        child->radius + tolerance) {
+      if (SSNode *leaf = child->findLeaf(entry)) {
+        return leaf;
+      }
     }
   }
+  return nullptr;
+}
 
-  if (node->isLeaf) {
-    for (auto &entry: node->_data) {
-      float dist = Point::distance(query, entry->getEmbedding());
-
-      if (max_heap.size() < k) {
-        max_heap.emplace(dist, entry);
-      } else if (dist < max_heap.top().first) {
-        max_heap.pop();
-        max_heap.emplace(dist, entry);
+/**
+ * remove
+ * Removes an entry from the subtree rooted at this node. Nodes left empty
+ * are unlinked from their parents and the spheres on the way up are
+ * refitted; underfull nodes are kept as they are.
+ * @param entry: Entry to remove.
+ * @return bool: True if the entry was found.
+ */
+bool SSNode::remove(Data *entry) {
+  SSNode *leaf = findLeaf(entry);
+  if (leaf == nullptr) {
+    return false;
+  }
+  std::erase(leaf->_data, entry);
+
+  SSNode *node = leaf;
+  while (node != this) {
+    SSNode *up = node->parent;
+    if (node->isLeaf ? node->_data.empty() : node->children.empty()) {
+      std::erase(up->children, node);
+      delete node;
+    } else {
+      node->updateBoundingEnvelope();
+    }
+    node = up;
+  }
+  if (isLeaf ? !_data.empty() : !children.empty()) {
+    updateBoundingEnvelope();
+  }
+  return true;
+}
+
+/**
+ * publishBound
+ * Lowers a shared pruning distance to value if value is smaller.
+ */
+static void publishBound(std::atomic<float> &shared, float value) {
+  float current = shared.load(std::memory_order_relaxed);
+  while (value < current &&
+         !shared.compare_exchange_weak(current, value,
+                                       std::memory_order_relaxed)) {
+  }
+}
+
+/**
+ * knn
+ * Depth-first k nearest neighbor search over the subtree rooted at this node.
+ * Candidates and pending nodes are kept in the context, so the search does
+ * not allocate once the context buffers have grown.
+ * With a shared bound, several searches running on other subtrees prune with
+ * the smallest k-th best distance any of them has found, and publish their
+ * own k-th best whenever their context is full.
+ * @param query: Query point.
+ * @param context: Scratch context, already reset for the wanted k.
+ * @param sharedBound: k-th best distance shared between tasks, or nullptr.
+ * @param filter: Metadata filter, or nullptr to accept every entry.
+ */
+void SSNode::knn(const Point &query, SSKnnContext &context,
+                 std::atomic<float> *sharedBound, const KnnFilter *filter) {
+  const float unbounded = std::numeric_limits<float>::max();
+  auto pruneDistance = [&]() {
+      float bound = context.full() ? context.worst() : unbounded;
+      if (sharedBound) {
+        bound = std::min(bound, sharedBound->load(std::memory_order_relaxed));
+      }
+      return bound;
+  };
+
+  context.push(0.0f, this);
+
+  while (context.hasPending()) {
+    SSNode *node = context.pop().second;
+    if (filter && !filter->mayMatch(*node)) {
+      continue;
+    }
+
+    float maxDistance = pruneDistance();
+    if (maxDistance < unbounded) {
+      float distanceToNode = Point::distance(query, node->getCenter());
+
+      if (maxDistance + node->getRadius() < distanceToNode) {
+        continue;
+      }
+    }
+
+    if (node->isLeaf) {
+      for (auto &entry: node->_data) {
+        if (filter && !filter->matches(*entry)) {
+          continue;
+        }
+        // Abandon the entry as soon as its partial squared distance exceeds
+        // the current k-th best
+        maxDistance = pruneDistance();
+        float bound = maxDistance < unbounded ? maxDistance * maxDistance
+                                              : unbounded;
+        float distSquared = query.distanceSquaredBounded(entry->getEmbedding(),
+                                                         bound);
+
+        if (distSquared < bound) {
+          context.offer(std::sqrt(distSquared), entry);
+          if (sharedBound && context.full()) {
+            publishBound(*sharedBound, context.worst());
+          }
+        }
+      }
+      continue;
+    }
+
+    // Reverse order so children are visited in their stored order
+    for (auto it = node->children.rbegin(); it != node->children.rend(); ++it) {
+      context.push(0.0f, *it);
+    }
+  }
+}
+
+/**
+ * knn
+ * Finds the k nearest neighbors of a query point.
+ * Uses a thread-local context, so only the returned vector is allocated.
+ * @param query: Query point.
+ * @param k: Number of neighbors.
+ * @return std::vector<Data *>: Neighbors sorted from closest to farthest.
+ */
+std::vector<Data *> SSTree::knn(Point &query, size_t k) {
+  static thread_local SSKnnContext context;
+
+  std::vector<Data *> result;
+  knn(query, k, context, result);
+  return result;
+}
+
+/**
+ * knn
+ * Finds the k nearest neighbors of a query point using caller-owned scratch
+ * space. Reusing the same context and result buffer across queries makes
+ * the steady state allocation-free.
+ * @param query: Query point.
+ * @param k: Number of neighbors.
+ * @param context: Scratch context reused across queries.
+ * @param result: Output buffer, cleared and filled closest first.
+ */
+void SSTree::knn(const Point &query, size_t k, SSKnnContext &context,
+                 std::vector<Data *> &result) const {
+  context.reset(k);
+  if (root && k > 0) {
+    root->knn(query, context);
+  }
+  context.drain(result);
+}
+
+void SSTree::knn(const Point &query, size_t k, SSKnnContext &context,
+                 std::vector<SSKnnContext::Entry> &result) const {
+  context.reset(k);
+  if (root && k > 0) {
+    root->knn(query, context);
+  }
+  context.drainEntries(result);
+}
+
+/**
+ * knn
+ * Finds the k nearest neighbors among the entries that match a metadata
+ * filter. The filter is pushed down into the traversal: subtrees whose
+ * summaries exclude every match are skipped, and only matching entries
+ * compete for the top-k, so k results are returned whenever k entries match.
+ * @param query: Query point.
+ * @param k: Number of neighbors.
+ * @param filter: Metadata filter.
+ * @return std::vector<Data *>: Matching neighbors, closest first.
+ */
+std::vector<Data *> SSTree::knn(const Point &query, size_t k,
+                                const KnnFilter &filter) const {
+  static thread_local SSKnnContext context;
+
+  std::vector<Data *> result;
+  context.reset(k);
+  if (root && k > 0) {
+    root->knn(query, context, nullptr, &filter);
+  }
+  context.drain(result);
+  return result;
+}
+
+using NodePair = std::pair<const SSNode *, const SSNode *>;
+using DataPair = std::pair<Data *, Data *>;
+
+/**
+ * spheresWithin
+ * Checks whether two bounding spheres may hold points within distance tau.
+ * @return bool: False if the minimum distance between the spheres exceeds tau.
+ */
+static bool spheresWithin(const SSNode *a, const SSNode *b, float tau) {
+  if (a == b) {
+    return true;
+  }
+  float gap = Point::distance(a->getCenter(), b->getCenter()) -
+              a->getRadius() - b->getRadius();
+  return gap <= tau;
+}
+
+/**
+ * forEachChildPair
+ * Expands a node pair one level down, calling visit on each child pair whose
+ * spheres may still hold matches. A node paired with itself expands into the
+ * unordered pairs of its children; otherwise the larger sphere is expanded.
+ */
+template<typename Visit>
+static void forEachChildPair(const SSNode *a, const SSNode *b, float tau,
+                             Visit visit) {
+  const auto &children = a->getChildren();
+  if (a == b) {
+    for (size_t i = 0; i < children.size(); ++i) {
+      for (size_t j = i; j < children.size(); ++j) {
+        if (spheresWithin(children[i], children[j], tau)) {
+          visit(children[i], children[j]);
+        }
       }
     }
     return;
   }
 
-  for (auto &child: node->children) {
-    child->knn(child, query, k, max_heap);
+  if (a->getIsLeaf() || (!b->getIsLeaf() && b->getRadius() > a->getRadius())) {
+    std::swap(a, b);
+  }
+  for (const SSNode *child: a->getChildren()) {
+    if (spheresWithin(child, b, tau)) {
+      visit(child, b);
+    }
   }
 }
 
-std::vector<Data *> SSTree::knn(Point &query, size_t k) {
-  std::priority_queue<std::pair<float, Data *>> max_heap;
-  if (root) {
-    root->knn(root, query, k, max_heap);
+/**
+ * joinLeaves
+ * Emits every pair of entries of two leaves within distance tau.
+ */
+static void joinLeaves(const SSNode *a, const SSNode *b, float tau,
+                       std::vector<DataPair> &out) {
+  float bound = tau * tau;
+  const auto &left = a->getData();
+  const auto &right = b->getData();
+  for (size_t i = 0; i < left.size(); ++i) {
+    for (size_t j = (a == b ? i + 1 : 0); j < right.size(); ++j) {
+      float dist = left[i]->getEmbedding().distanceSquaredBounded(
+              right[j]->getEmbedding(), bound);
+      if (dist <= bound) {
+        out.emplace_back(left[i], right[j]);
+      }
+    }
+  }
+}
+
+/**
+ * joinNodes
+ * Dual-tree traversal emitting the pairs of entries within distance tau
+ * found under a pair of nodes.
+ */
+static void joinNodes(const SSNode *a, const SSNode *b, float tau,
+                      std::vector<DataPair> &out) {
+  if (a->getIsLeaf() && b->getIsLeaf()) {
+    joinLeaves(a, b, tau, out);
+    return;
+  }
+  forEachChildPair(a, b, tau, [&](const SSNode *x, const SSNode *y) {
+      joinNodes(x, y, tau, out);
+  });
+}
+
+/**
+ * selfJoin
+ * Finds every pair of entries whose distance is at most tau with a dual-tree
+ * walk over pairs of nodes, pruning pairs of spheres that are farther apart
+ * than tau. The top of the walk is expanded into independent node pairs
+ * that threads take from a shared counter, each filling its own buffer.
+ * @param tau: Maximum distance between the entries of a pair.
+ * @param numThreads: Number of threads (0 uses all cores).
+ * @return std::vector<std::pair<Data *, Data *>>: Each matching pair once.
+ */
+std::vector<DataPair> SSTree::selfJoin(float tau, size_t numThreads) const {
+  std::vector<DataPair> result;
+  if (!root) {
+    return result;
+  }
+  numThreads = resolveThreads(numThreads);
+
+  // Expand the root pair until there is enough work to balance the threads
+  std::vector<NodePair> tasks = {{root, root}};
+  while (tasks.size() < numThreads * 8) {
+    std::vector<NodePair> next;
+    bool expanded = false;
+    for (const auto &[a, b]: tasks) {
+      if (a->getIsLeaf() && b->getIsLeaf()) {
+        next.emplace_back(a, b);
+        continue;
+      }
+      expanded = true;
+      forEachChildPair(a, b, tau, [&](const SSNode *x, const SSNode *y) {
+          next.emplace_back(x, y);
+      });
+    }
+    tasks = std::move(next);
+    if (!expanded) {
+      break;
+    }
+  }
+
+  std::vector<std::vector<DataPair>> buffers(numThreads);
+  std::atomic<size_t> nextTask(0);
+  parallelFor(0, numThreads, numThreads, [&](size_t thread, size_t, size_t) {
+      for (size_t t = nextTask++; t < tasks.size(); t = nextTask++) {
+        joinNodes(tasks[t].first, tasks[t].second, tau, buffers[thread]);
+      }
+  });
+
+  for (auto &buffer: buffers) {
+    result.insert(result.end(), buffer.begin(), buffer.end());
+  }
+  return result;
+}
+
+/**
+ * nearDuplicates
+ * Runs selfJoin and reports the matching pairs by image path.
+ * @param tau: Maximum distance between duplicates.
+ * @param numThreads: Number of threads (0 uses all cores).
+ * @return std::vector<std::pair<std::string, std::string>>: Duplicate paths.
+ */
+std::vector<std::pair<std::string, std::string>>
+SSTree::nearDuplicates(float tau, size_t numThreads) const {
+  std::vector<std::pair<std::string, std::string>> duplicates;
+  for (const auto &[a, b]: selfJoin(tau, numThreads)) {
+    duplicates.emplace_back(a->getPath(), b->getPath());
+  }
+  return duplicates;
+}
+
+/**
+ * quality
+ * Collects shape statistics of the tree: size, mean radius, total sphere
+ * volume and the overlap between sibling spheres. Looser, more overlapping
+ * spheres mean more nodes visited per query.
+ * @return SSTreeQuality: Statistics of the current tree.
+ */
+SSTreeQuality SSTree::quality() const {
+  SSTreeQuality stats;
+  if (!root) {
+    return stats;
+  }
+
+  // log of the volume of the unit ball in DIM dimensions
+  const double d = static_cast<double>(DIM);
+  const double logUnitBall = d / 2.0 * std::log(std::numbers::pi) -
+                             std::lgamma(d / 2.0 + 1.0);
+  double radiusSum = 0.0;
+
+  std::vector<std::pair<const SSNode *, size_t>> stack = {{root, 1}};
+  while (!stack.empty()) {
+    auto [node, depth] = stack.back();
+    stack.pop_back();
+
+    stats.nodeCount++;
+    stats.height = std::max(stats.height, depth);
+    radiusSum += node->getRadius();
+    if (node->getRadius() > 0.0f) {
+      double logVolume = logUnitBall + d * std::log(node->getRadius());
+      double hi = std::max(stats.logTotalVolume, logVolume);
+      double lo = std::min(stats.logTotalVolume, logVolume);
+      stats.logTotalVolume = hi + std::log1p(std::exp(lo - hi));
+    }
+
+    if (node->getIsLeaf()) {
+      stats.leafCount++;
+      continue;
+    }
+
+    const auto &children = node->getChildren();
+    for (size_t i = 0; i < children.size(); ++i) {
+      for (size_t j = i + 1; j < children.size(); ++j) {
+        double overlap = children[i]->getRadius() + children[j]->getRadius() -
+                         Point::distance(children[i]->getCenter(),
+                                         children[j]->getCenter());
+        if (overlap > 0.0) {
+          stats.siblingOverlap += overlap;
+          stats.overlappingPairs++;
+        }
+      }
+      stack.emplace_back(children[i], depth + 1);
+    }
   }
 
+  stats.meanRadius = radiusSum / static_cast<double>(stats.nodeCount);
+  return stats;
+}
+
+/**
+ * parallelKnn
+ * Intra-query parallel kNN. The top levels of the tree are split into
+ * independent subtrees, ordered by the distance from the query to their
+ * spheres; worker threads take subtrees from a shared counter and search
+ * them with their own context. All workers prune with a shared atomic k-th
+ * best distance, and their local results are merged at the end.
+ * @param query: Query point.
+ * @param k: Number of neighbors.
+ * @param numThreads: Number of threads (0 uses all cores).
+ * @return std::vector<Data *>: Neighbors sorted from closest to farthest.
+ */
+std::vector<Data *> SSTree::parallelKnn(const Point &query, size_t k,
+                                        size_t numThreads) const {
   std::vector<Data *> result;
-  while (!max_heap.empty()) {
-    result.emplace_back(max_heap.top().second);
-    max_heap.pop();
+  if (!root || k == 0) {
+    return result;
   }
+  numThreads = resolveThreads(numThreads);
 
-  // Reverse the vector to have the closest points in the correct order
-  std::reverse(result.begin(), result.end());
+  std::vector<SSNode *> subtrees = {root};
+  while (subtrees.size() < numThreads * 4) {
+    std::vector<SSNode *> next;
+    bool expanded = false;
+    for (SSNode *node: subtrees) {
+      if (node->getIsLeaf()) {
+        next.push_back(node);
+      } else {
+        expanded = true;
+        next.insert(next.end(), node->children.begin(), node->children.end());
+      }
+    }
+    subtrees = std::move(next);
+    if (!expanded) {
+      break;
+    }
+  }
+
+  // Closest subtrees first, so the shared bound tightens early
+  std::vector<std::pair<float, SSNode *>> tasks;
+  for (SSNode *node: subtrees) {
+    tasks.emplace_back(Point::distance(query, node->getCenter()) -
+                       node->getRadius(), node);
+  }
+  std::sort(tasks.begin(), tasks.end());
 
+  std::atomic<float> sharedBound(std::numeric_limits<float>::max());
+  std::atomic<size_t> nextTask(0);
+  std::vector<SSKnnContext> contexts(numThreads);
+  parallelFor(0, numThreads, numThreads, [&](size_t thread, size_t, size_t) {
+      contexts[thread].reset(k);
+      for (size_t t = nextTask++; t < tasks.size(); t = nextTask++) {
+        tasks[t].second->knn(query, contexts[thread], &sharedBound);
+      }
+  });
+
+  SSKnnContext merged(k);
+  for (const auto &context: contexts) {
+    for (const auto &[dist, entry]: context.getEntries()) {
+      merged.offer(dist, entry);
+    }
+  }
+  merged.drain(result);
   return result;
-}
\ No newline at end of file
+}
@@ -0,0 +1,113 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include "quadtree.h"
+#include "linearquadtree.h"
+
+constexpr size_t NUM_PARTICLES = 200000;
+constexpr size_t NUM_FRAMES = 10;
+constexpr size_t NUM_QUERIES = 1000;
+
+using Clock = std::chrono::high_resolution_clock;
+
+double elapsedMs(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+ParticleSystem generateParticles(size_t n, double maxVelocity) {
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> position(0, 100);
+    std::uniform_real_distribution<double> velocity(-maxVelocity, maxVelocity);
+    ParticleSystem particles;
+    particles.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        particles.add(Point2D(position(gen), position(gen)),
+                      Point2D(velocity(gen), velocity(gen)));
+    }
+    return particles;
+}
+
+// Costo por cuadro: actualizar el QuadTree en su lugar vs reconstruir el lineal
+void compareFrameUpdate(double maxVelocity) {
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    ParticleSystem forTree = generateParticles(NUM_PARTICLES, maxVelocity);
+    ParticleSystem forLinear = forTree;
+
+    QuadTree tree(boundary);
+    auto start = Clock::now();
+    tree.insert(forTree);
+    auto inserted = Clock::now();
+    LinearQuadTree linear(boundary);
+    linear.build(forLinear);
+    auto built = Clock::now();
+
+    double updateMs = 0, rebuildMs = 0;
+    for (size_t frame = 0; frame < NUM_FRAMES; ++frame) {
+        forTree.updatePositions(boundary);
+        forLinear.updatePositions(boundary);
+        auto t0 = Clock::now();
+        tree.updateTree();
+        auto t1 = Clock::now();
+        linear.build(forLinear);
+        auto t2 = Clock::now();
+        updateMs += elapsedMs(t0, t1);
+        rebuildMs += elapsedMs(t1, t2);
+    }
+
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<double> coordinate(0, 100);
+    std::vector<Point2D> queries;
+    for (size_t i = 0; i < NUM_QUERIES; ++i) {
+        queries.emplace_back(coordinate(gen), coordinate(gen));
+    }
+    auto q0 = Clock::now();
+    for (auto &query: queries) {
+        tree.knn(query, 10);
+    }
+    auto q1 = Clock::now();
+    for (auto &query: queries) {
+        linear.knn(query, 10);
+    }
+    auto q2 = Clock::now();
+
+    std::cout << NUM_PARTICLES << " partículas, velocidad máxima "
+              << maxVelocity << std::endl;
+    std::cout << "  construcción: QuadTree " << elapsedMs(start, inserted)
+              << " ms, lineal " << elapsedMs(inserted, built) << " ms"
+              << std::endl;
+    std::cout << "  por cuadro: updateTree "
+              << updateMs / NUM_FRAMES << " ms, reconstrucción lineal "
+              << rebuildMs / NUM_FRAMES << " ms" << std::endl;
+    std::cout << "  KNN promedio: QuadTree "
+              << elapsedMs(q0, q1) * 1000 / NUM_QUERIES << " us, lineal "
+              << elapsedMs(q1, q2) * 1000 / NUM_QUERIES << " us" << std::endl;
+}
+
+// Pares a distancia r en una sola pasada de fase amplia
+void compareCollisionPairs(double radius) {
+    Rect boundary(Point2D(0, 0), Point2D(100, 100));
+    ParticleSystem particles = generateParticles(NUM_PARTICLES, 1.0);
+    QuadTree tree(boundary);
+    tree.insert(particles);
+
+    std::vector<ParticlePair> pairs;
+    auto start = Clock::now();
+    tree.collisionPairs(radius, pairs);
+    auto end = Clock::now();
+
+    std::cout << "Pares a distancia " << radius << ": " << pairs.size()
+              << " en " << elapsedMs(start, end) << " ms ("
+              << elapsedMs(start, end) * 1e6 / NUM_PARTICLES
+              << " ns por partícula)" << std::endl;
+}
+
+int main() {
+    for (double maxVelocity: {0.05, 5.0}) {
+        compareFrameUpdate(maxVelocity);
+    }
+    for (double radius: {0.05, 0.2}) {
+        compareCollisionPairs(radius);
+    }
+    return 0;
+}
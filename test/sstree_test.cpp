@@ -2,9 +2,11 @@
 #include <vector>
 #include <unordered_set>
 #include <random>
+#include <chrono>
 #include "point.h"
 #include "data.h"
 #include "sstree.h"
+#include "pagedsstree.h"
 
 constexpr size_t NUM_POINTS = 10000;
 constexpr size_t MAX_POINTS_PER_NODE = 20;
@@ -158,6 +160,69 @@ bool correctKnnSearch(SSTree tree, std::vector<Data *> &data) {
 }
 
 
+// Construcción con y sin reinserción forzada: calidad del árbol y costo de KNN
+void compareReinsertion(const std::vector<Data *> &data) {
+  std::vector<Point> queries;
+  for (size_t i = 0; i < 100; ++i) {
+    queries.push_back(Point::random());
+  }
+
+  for (float fraction: {0.0f, 0.3f}) {
+    SSTree tree(MAX_POINTS_PER_NODE, fraction);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const auto &d: data) {
+      tree.insert(d);
+    }
+    auto built = std::chrono::high_resolution_clock::now();
+    for (auto &query: queries) {
+      tree.knn(query, 10);
+    }
+    auto queried = std::chrono::high_resolution_clock::now();
+
+    SSTreeQuality stats = tree.quality();
+    std::cout << "Reinserción " << fraction * 100 << "%: "
+              << "altura " << stats.height << ", nodos " << stats.nodeCount
+              << ", radio medio " << stats.meanRadius
+              << ", log volumen total " << stats.logTotalVolume
+              << ", solapamiento entre hermanos " << stats.siblingOverlap
+              << " (" << stats.overlappingPairs << " pares)" << std::endl;
+    std::cout << "  construcción "
+              << std::chrono::duration<double, std::milli>(built - start).count()
+              << " ms, KNN promedio "
+              << std::chrono::duration<double, std::micro>(queried - built).count() /
+                 static_cast<double>(queries.size())
+              << " us" << std::endl;
+  }
+}
+
+// KNN paginado con pools de distinto tamaño: aciertos, fallos y costo
+void comparePoolSizes(const SSTree &tree) {
+  const std::string path = "sstree_pages.bin";
+  std::vector<Point> queries;
+  for (size_t i = 0; i < 100; ++i) {
+    queries.push_back(Point::random());
+  }
+
+  for (size_t poolPages: {8, 64, 512}) {
+    PagedSSTree paged(tree, path, poolPages);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto &query: queries) {
+      paged.knn(query, 10);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    BufferPoolStats stats = paged.getStats();
+    std::cout << "Pool de " << poolPages << " de " << paged.getNumPages()
+              << " páginas: aciertos " << stats.hits << ", fallos "
+              << stats.misses << ", lectura anticipada " << stats.readAheads
+              << ", KNN promedio "
+              << std::chrono::duration<double, std::micro>(end - start).count() /
+                 static_cast<double>(queries.size())
+              << " us" << std::endl;
+  }
+  std::remove(path.c_str());
+}
+
 int main() {
   auto data = generateRandomData(NUM_POINTS);
   SSTree tree(MAX_POINTS_PER_NODE);
@@ -172,6 +237,8 @@ int main() {
                                            MAX_POINTS_PER_NODE);
   bool spherePoints = sphereCoversAllPoints(tree.getRoot());
   bool sphereChildren = sphereCoversAllChildrenSpheres(tree.getRoot());
+  compareReinsertion(data);
+  comparePoolSizes(tree);
   bool testKnn = correctKnnSearch(tree, data);
 
   std::cout << "Todos los datos presentes: " << (allPresent ? "Sí" : "No")